@@ -0,0 +1,80 @@
+/*
+ * arena.c - bufpool 블록 위의 요청별 bump 할당기
+ */
+#include "csapp.h"
+#include "arena.h"
+#include "bufpool.h"
+
+#define BLOCK_HDR ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static unsigned long blocks, oversize; // 첫 블록 다음에 받은 블록 / 그중 16KB보다 큰 블록
+
+/* 블록을 풀에 돌려준다 */
+static void release_block(arena_block_t *block)
+{
+  growbuf_t buf = { (char *)block, block->size };
+
+  growbuf_free(&buf);
+}
+
+/* 새 블록을 받아 현재 블록으로 만든다. 첫 블록은 작게, 그다음은 크게, need가 더 크면 need만큼 */
+static int new_block(arena_t *a, size_t need)
+{
+  growbuf_t buf = { NULL, 0 };
+  arena_block_t *block;
+
+  need += BLOCK_HDR;
+  if (need < (a->block ? BUFPOOL_LARGE : BUFPOOL_SMALL))
+    need = a->block ? BUFPOOL_LARGE : BUFPOOL_SMALL;
+  if (growbuf_reserve(&buf, need) < 0)
+    return -1;
+  if (a->block)
+    __sync_fetch_and_add(&blocks, 1);
+  if (buf.size > BUFPOOL_LARGE)
+    __sync_fetch_and_add(&oversize, 1);
+
+  block = (arena_block_t *)buf.ptr;
+  block->prev = a->block;
+  block->size = buf.size;
+  a->block = block;
+  a->cur = buf.ptr + BLOCK_HDR;
+  a->end = buf.ptr + buf.size;
+  return 0;
+}
+
+/* arena_alloc - ARENA_ALIGN으로 정렬된 size 바이트를 돌려준다. 메모리가 없으면 NULL */
+void *arena_alloc(arena_t *a, size_t size)
+{
+  char *p;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (size > (size_t)(a->end - a->cur) && new_block(a, size) < 0)
+    return NULL;
+  p = a->cur;
+  a->cur += size;
+  return p;
+}
+
+/* arena_free - 블록을 모두 풀에 돌려준다. 그 뒤에도 다시 쓸 수 있다 */
+void arena_free(arena_t *a)
+{
+  arena_block_t *block = a->block;
+
+  while (block) {
+    arena_block_t *prev = block->prev;
+    release_block(block);
+    block = prev;
+  }
+  a->block = NULL;
+  a->cur = a->end = NULL;
+}
+
+int arena_stats(char *buf, int size)
+{
+  int len = snprintf(buf, size,
+                     "arena_extra_blocks %lu\n"
+                     "arena_oversize_blocks %lu\n",
+                     __atomic_load_n(&blocks, __ATOMIC_RELAXED),
+                     __atomic_load_n(&oversize, __ATOMIC_RELAXED));
+  return len < size ? len : size;
+}
@@ -0,0 +1,34 @@
+/*
+ * arena.h - 요청마다 쓰는 bump 포인터 할당기
+ *
+ * 요청 줄에서 나눈 문자열, 변형 키, 오류 응답, 캐싱하지 않는 본문처럼 요청이 끝나면 버릴
+ * 메모리는 모두 연결의 arena에서 포인터만 밀어 받는다. 블록은 bufpool에서 빌리고(첫 블록은
+ * 4KB, 모자라면 16KB, 그보다 큰 할당은 그 크기의 블록 하나) 하나씩 풀어 주지 않는다.
+ * 연결 하나가 요청 하나를 처리하므로 연결이 끝날 때 arena_free로 블록을 모두 풀에 돌려준다.
+ * 범용 할당기는 캐시에 넣는 객체에만 쓰게 된다.
+ */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+#define ARENA_ALIGN 16
+
+typedef struct arena_block_t
+{
+  struct arena_block_t *prev; // 먼저 받은 블록
+  size_t size;                // 헤더를 포함한 블록 크기
+} arena_block_t;
+
+/* {NULL, NULL, NULL}로 시작한다 */
+typedef struct
+{
+  char *cur, *end;      // 현재 블록의 남은 공간
+  arena_block_t *block; // 현재 블록
+} arena_t;
+
+void *arena_alloc(arena_t *a, size_t size);
+void arena_free(arena_t *a);
+int arena_stats(char *buf, int size);
+
+#endif /* __ARENA_H__ */
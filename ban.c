@@ -0,0 +1,243 @@
+/*
+ * ban.c - 지연 평가되는 캐시 무효화
+ *
+ * 시각은 마이크로초 단위이고, 밴 시각이 객체의 cached_at 이상이면 그 객체는 무효다.
+ * 가장 최근 밴 시각(last_ban)보다 나중에 캐싱된 객체는 바로 통과한다.
+ *
+ * 트라이 노드와 태그는 붙이기만 하고 떼거나 해제하지 않으므로, 쓰는 쪽(ban_lock)이 다 채운
+ * 노드를 release로 달면 ban_check는 락도 원자적 read-modify-write도 없이 따라갈 수 있다.
+ * 밴 시각은 노드에 먼저 적고 last_ban을 나중에 올린다.
+ */
+#include "ban.h"
+
+/* 접두사 트라이 노드 (first-child / next-sibling) */
+typedef struct ban_node_t
+{
+  uint64_t banned_at; // 이 노드에서 끝나는 접두사의 마지막 밴 시각 (0이면 없음)
+  struct ban_node_t *child, *sibling;
+  char c;
+} ban_node_t;
+
+typedef struct ban_tag_t
+{
+  uint64_t purged_at;
+  uint32_t id;
+  struct ban_tag_t *hnext;
+  char name[];
+} ban_tag_t;
+
+static pthread_mutex_t ban_lock = PTHREAD_MUTEX_INITIALIZER; // 쓰는 쪽끼리만
+static ban_node_t root;
+static ban_tag_t *tag_buckets[BAN_TAG_BUCKETS];
+static ban_tag_t *tags[BAN_MAX_TAG_IDS]; // id -> 태그 (다시 할당하지 않는다)
+static uint32_t ntags;
+static uint64_t last_ban; // 가장 최근의 밴 또는 태그 퍼지 시각
+
+static unsigned long prefix_bans, tag_purges, nodes, invalidated;
+
+uint64_t ban_now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * 새 밴 시각. 같은 마이크로초에 발행돼도 순서가 유지되도록 항상 증가시킨다. ban_lock 아래에서
+ * 호출하고, 노드나 태그에 적은 뒤 publish_stamp로 알린다
+ */
+static uint64_t next_stamp(void)
+{
+  uint64_t now = ban_now();
+
+  return now <= last_ban ? last_ban + 1 : now;
+}
+
+static void publish_stamp(uint64_t stamp)
+{
+  __atomic_store_n(&last_ban, stamp, __ATOMIC_RELEASE);
+}
+
+static ban_node_t *find_child(ban_node_t *node, char c)
+{
+  for (node = __atomic_load_n(&node->child, __ATOMIC_ACQUIRE); node && node->c != c;
+       node = node->sibling)
+    ;
+  return node;
+}
+
+/* ban_prefix - 키가 prefix[0, len)으로 시작하는 지금까지의 객체를 모두 무효화 */
+void ban_prefix(char *prefix, int len)
+{
+  ban_node_t *node = &root, *child;
+  uint64_t stamp;
+  int i;
+
+  pthread_mutex_lock(&ban_lock);
+  for (i = 0; i < len; i++) {
+    if (!(child = find_child(node, prefix[i]))) {
+      child = Calloc(1, sizeof(ban_node_t));
+      child->c = prefix[i];
+      child->sibling = node->child;
+      __atomic_store_n(&node->child, child, __ATOMIC_RELEASE);
+      nodes++;
+    }
+    node = child;
+  }
+  stamp = next_stamp();
+  __atomic_store_n(&node->banned_at, stamp, __ATOMIC_RELAXED);
+  publish_stamp(stamp);
+  prefix_bans++;
+  pthread_mutex_unlock(&ban_lock);
+}
+
+static uint32_t tag_hash(char *name, int len)
+{
+  uint32_t h = 2166136261u;
+
+  while (len-- > 0)
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  return h;
+}
+
+/* 태그를 찾고, create면 없을 때 새로 만든다. create면 ban_lock 아래에서 호출 */
+static ban_tag_t *find_tag(char *name, int len, int create)
+{
+  ban_tag_t **pp = &tag_buckets[tag_hash(name, len) & (BAN_TAG_BUCKETS - 1)], *tag;
+
+  for (tag = __atomic_load_n(pp, __ATOMIC_ACQUIRE); tag; tag = tag->hnext)
+    if (!strncmp(tag->name, name, len) && !tag->name[len])
+      return tag;
+  if (!create || ntags >= BAN_MAX_TAG_IDS)
+    return NULL;
+
+  tag = Malloc(sizeof(ban_tag_t) + len + 1);
+  tag->purged_at = 0;
+  tag->id = ntags;
+  memcpy(tag->name, name, len);
+  tag->name[len] = '\0';
+  tag->hnext = *pp;
+  tags[ntags] = tag;
+  __atomic_store_n(&ntags, ntags + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(pp, tag, __ATOMIC_RELEASE);
+  return tag;
+}
+
+/* 공백으로 구분된 다음 태그의 시작과 길이. 없으면 NULL */
+static char *next_tag(char **sp, int *len)
+{
+  char *s = *sp, *start;
+
+  while (*s && isspace((unsigned char)*s))
+    s++;
+  if (!*s)
+    return NULL;
+  for (start = s; *s && !isspace((unsigned char)*s); s++)
+    ;
+  *len = s - start;
+  *sp = s;
+  return start;
+}
+
+/* ban_tags - 공백으로 구분된 태그들이 붙은 지금까지의 객체를 모두 무효화하고 알려진 태그 수를 반환 */
+int ban_tags(char *names)
+{
+  ban_tag_t *tag;
+  uint64_t stamp = 0;
+  char *name;
+  int len, n = 0;
+
+  pthread_mutex_lock(&ban_lock);
+  while ((name = next_tag(&names, &len))) {
+    if (len > BAN_MAX_TAG_LEN || !(tag = find_tag(name, len, 0)))
+      continue;
+    if (!stamp)
+      stamp = next_stamp();
+    __atomic_store_n(&tag->purged_at, stamp, __ATOMIC_RELAXED);
+    tag_purges++;
+    n++;
+  }
+  if (stamp)
+    publish_stamp(stamp);
+  pthread_mutex_unlock(&ban_lock);
+  return n;
+}
+
+/*
+ * ban_intern_tags - 응답의 Surrogate-Key 값을 태그 id 배열로 바꾸고 개수를 반환.
+ * 태그가 BAN_MAX_TAGS보다 많거나 너무 길거나 태그 표가 차면 -1 (그 응답은 캐싱하지 않는다).
+ * 이미 있는 태그는 락 없이 찾고, 처음 보는 태그를 만들 때만 ban_lock을 잡는다
+ */
+int ban_intern_tags(char *names, uint32_t *ids)
+{
+  ban_tag_t *tag;
+  char *name;
+  int len, n = 0, locked = 0;
+
+  while ((name = next_tag(&names, &len))) {
+    if (n == BAN_MAX_TAGS || len > BAN_MAX_TAG_LEN) {
+      n = -1;
+      break;
+    }
+    if (!(tag = find_tag(name, len, 0))) {
+      if (!locked) {
+        pthread_mutex_lock(&ban_lock);
+        locked = 1;
+      }
+      if (!(tag = find_tag(name, len, 1))) {
+        n = -1;
+        break;
+      }
+    }
+    ids[n++] = tag->id;
+  }
+  if (locked)
+    pthread_mutex_unlock(&ban_lock);
+  return n;
+}
+
+/*
+ * ban_check - cached_at에 캐싱된 객체가 그 뒤에 발행된 접두사 밴이나 태그 퍼지에
+ * 걸리면 1. 호출자는 1이면 객체를 지우고 미스로 처리한다. 락을 잡지 않는다.
+ */
+int ban_check(char *key, int key_len, uint64_t cached_at, uint32_t *ids, int nids)
+{
+  uint64_t last = __atomic_load_n(&last_ban, __ATOMIC_ACQUIRE);
+  ban_node_t *node = &root;
+  uint32_t known = __atomic_load_n(&ntags, __ATOMIC_ACQUIRE);
+  uint64_t at;
+  int i, banned = 0;
+
+  if (!last || cached_at > last)
+    return 0;
+
+  for (i = 0; i < key_len && !banned && (node = find_child(node, key[i])); i++) {
+    at = __atomic_load_n(&node->banned_at, __ATOMIC_RELAXED);
+    banned = at && at >= cached_at;
+  }
+  for (i = 0; i < nids && !banned; i++) {
+    at = ids[i] < known ? __atomic_load_n(&tags[ids[i]]->purged_at, __ATOMIC_RELAXED) : 0;
+    banned = at && at >= cached_at;
+  }
+
+  if (banned)
+    __sync_fetch_and_add(&invalidated, 1);
+  return banned;
+}
+
+int ban_stats(char *buf, int size)
+{
+  int len;
+
+  pthread_mutex_lock(&ban_lock);
+  len = snprintf(buf, size,
+                 "ban_prefix_bans %lu\n"
+                 "ban_trie_nodes %lu\n"
+                 "ban_tags %u\n"
+                 "ban_tag_purges %lu\n"
+                 "ban_invalidated %lu\n",
+                 prefix_bans, nodes, ntags, tag_purges, invalidated);
+  pthread_mutex_unlock(&ban_lock);
+  return len < size ? len : size;
+}
@@ -0,0 +1,26 @@
+/*
+ * ban.h - URL 접두사 밴과 Surrogate-Key 태그 퍼지
+ *
+ * 밴과 태그 퍼지는 발행 시각만 기록하고 캐시를 훑지 않는다. 객체는 캐싱된 시각(cached_at)을
+ * 갖고 있어서, 조회할 때 그 뒤에 발행된 밴이 키의 접두사나 태그에 걸려 있으면 그 자리에서 지운다.
+ * 접두사는 바이트 트라이에 넣으므로 검사 비용은 밴 개수와 상관없이 키 길이에 비례한다.
+ */
+#ifndef __BAN_H__
+#define __BAN_H__
+
+#include <stdint.h>
+#include "csapp.h"
+
+#define BAN_MAX_TAGS 8       // 객체 하나에 붙일 수 있는 태그 수
+#define BAN_MAX_TAG_LEN 128
+#define BAN_TAG_BUCKETS 4096 // 2의 거듭제곱
+#define BAN_MAX_TAG_IDS 65536
+
+uint64_t ban_now(void);
+void ban_prefix(char *prefix, int len);
+int ban_tags(char *tags);
+int ban_intern_tags(char *tags, uint32_t *ids);
+int ban_check(char *key, int key_len, uint64_t cached_at, uint32_t *tags, int ntags);
+int ban_stats(char *buf, int size);
+
+#endif /* __BAN_H__ */
@@ -0,0 +1,181 @@
+/*
+ * bufpool.c - 락 없는 4KB/16KB 버퍼 풀과 growbuf
+ */
+#include "csapp.h"
+#include "bufpool.h"
+
+typedef struct
+{
+  size_t size;         // 버퍼 크기
+  uint32_t count;      // 영역의 버퍼 수
+  char *base;          // mmap 영역 (예약에 실패하면 NULL: 항상 malloc)
+  uint32_t *next;      // 빈 버퍼 스택에서 아래 버퍼의 인덱스 + 1 (0이면 바닥)
+  uint64_t head;       // 세대 번호(상위 32비트) | 맨 위 버퍼의 인덱스 + 1
+  uint32_t fresh;      // 아직 한 번도 나눠 주지 않은 첫 인덱스
+  unsigned long used;  // 빌려 간 버퍼 수
+} pool_t;
+
+static pool_t pools[] = {
+  { BUFPOOL_SMALL, BUFPOOL_SMALL_COUNT },
+  { BUFPOOL_LARGE, BUFPOOL_LARGE_COUNT },
+};
+#define NPOOLS (int)(sizeof(pools) / sizeof(pools[0]))
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static unsigned long grows, fallbacks, oversize;
+
+static void pool_init(void)
+{
+  for (int i = 0; i < NPOOLS; i++) {
+    pool_t *p = &pools[i];
+    char *base = mmap(NULL, p->size * p->count, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (base == MAP_FAILED || !(p->next = calloc(p->count, sizeof(uint32_t)))) {
+      if (base != MAP_FAILED)
+        munmap(base, p->size * p->count);
+      continue;
+    }
+    p->base = base;
+  }
+}
+
+/* 빈 버퍼를 꺼낸다. 스택이 비었으면 아직 쓰지 않은 버퍼를, 그것도 없으면 NULL */
+static char *pool_pop(pool_t *p)
+{
+  uint64_t head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE), new;
+  uint32_t top, i;
+
+  if (!p->base)
+    return NULL;
+  do {
+    if (!(top = (uint32_t)head))
+      break;
+    // 그 사이 다른 스레드가 꺼내 갔다면 세대가 바뀌어 CAS가 실패하므로 next가 낡아도 된다
+    new = ((head >> 32) + 1) << 32 | __atomic_load_n(&p->next[top - 1], __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(&p->head, &head, new, 1, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_ACQUIRE));
+  if (top)
+    return p->base + (size_t)(top - 1) * p->size;
+
+  if (__atomic_load_n(&p->fresh, __ATOMIC_RELAXED) < p->count &&
+      (i = __atomic_fetch_add(&p->fresh, 1, __ATOMIC_RELAXED)) < p->count)
+    return p->base + (size_t)i * p->size;
+  return NULL;
+}
+
+/* 버퍼를 빈 버퍼 스택에 돌려준다 */
+static void pool_push(pool_t *p, char *buf)
+{
+  uint32_t i = (buf - p->base) / p->size + 1;
+  uint64_t head = __atomic_load_n(&p->head, __ATOMIC_RELAXED);
+
+  do
+    __atomic_store_n(&p->next[i - 1], (uint32_t)head, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&p->head, &head, ((head >> 32) + 1) << 32 | i, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* buf가 들어 있는 풀, malloc한 버퍼면 NULL */
+static pool_t *pool_of(char *buf)
+{
+  for (int i = 0; i < NPOOLS; i++)
+    if (pools[i].base && buf >= pools[i].base && buf < pools[i].base + pools[i].size * pools[i].count)
+      return &pools[i];
+  return NULL;
+}
+
+/*
+ * growbuf_reserve - b가 need 바이트 이상이 되게 한다. 담을 수 있는 가장 작은 풀 버퍼로,
+ * 풀 크기를 넘거나 풀이 비었으면 malloc으로 옮기고 기존 내용은 그대로 둔다.
+ * 메모리가 없으면 b를 건드리지 않고 -1
+ */
+int growbuf_reserve(growbuf_t *b, size_t need)
+{
+  pool_t *p = NULL;
+  char *ptr = NULL;
+  size_t size = need;
+  int i;
+
+  if (need <= b->size)
+    return 0;
+  Pthread_once(&pool_once, pool_init);
+
+  for (i = 0; i < NPOOLS; i++) {
+    if (need <= pools[i].size) {
+      if ((ptr = pool_pop(&pools[i]))) {
+        p = &pools[i];
+        size = p->size;
+      }
+      break;
+    }
+  }
+  if (!ptr) {
+    if (i == NPOOLS) { // 풀보다 크다: 다시 커질 때 복사가 반복되지 않게 두 배씩
+      if (size < b->size * 2)
+        size = b->size * 2;
+      __sync_fetch_and_add(&oversize, 1);
+    } else {
+      size = pools[i].size;
+      __sync_fetch_and_add(&fallbacks, 1);
+    }
+    if (!(ptr = malloc(size)))
+      return -1;
+  } else {
+    __sync_fetch_and_add(&p->used, 1);
+  }
+
+  if (b->ptr) {
+    memcpy(ptr, b->ptr, b->size);
+    growbuf_free(b);
+    __sync_fetch_and_add(&grows, 1);
+  }
+  b->ptr = ptr;
+  b->size = size;
+  return 0;
+}
+
+/* growbuf_free - 버퍼를 풀(또는 malloc)에 돌려주고 b를 빈 상태로 만든다 */
+void growbuf_free(growbuf_t *b)
+{
+  pool_t *p;
+
+  if (!b->ptr)
+    return;
+  if ((p = pool_of(b->ptr))) {
+    pool_push(p, b->ptr);
+    __sync_fetch_and_sub(&p->used, 1);
+  } else {
+    free(b->ptr);
+  }
+  b->ptr = NULL;
+  b->size = 0;
+}
+
+/* 한 번이라도 나눠 준(페이지가 잡힌) 버퍼 수 */
+static uint32_t touched(pool_t *p)
+{
+  uint32_t n = __atomic_load_n(&p->fresh, __ATOMIC_RELAXED);
+
+  return n < p->count ? n : p->count;
+}
+
+int bufpool_stats(char *buf, int size)
+{
+  int len = snprintf(buf, size,
+                     "bufpool_small_used %lu\n"
+                     "bufpool_small_touched %u\n"
+                     "bufpool_large_used %lu\n"
+                     "bufpool_large_touched %u\n"
+                     "bufpool_grows %lu\n"
+                     "bufpool_fallbacks %lu\n"
+                     "bufpool_oversize %lu\n",
+                     __atomic_load_n(&pools[0].used, __ATOMIC_RELAXED),
+                     touched(&pools[0]),
+                     __atomic_load_n(&pools[1].used, __ATOMIC_RELAXED),
+                     touched(&pools[1]),
+                     __atomic_load_n(&grows, __ATOMIC_RELAXED),
+                     __atomic_load_n(&fallbacks, __ATOMIC_RELAXED),
+                     __atomic_load_n(&oversize, __ATOMIC_RELAXED));
+  return len < size ? len : size;
+}
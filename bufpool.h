@@ -0,0 +1,34 @@
+/*
+ * bufpool.h - 연결별 I/O 버퍼 풀
+ *
+ * 연결 스레드가 요청 줄, 헤더, rio 버퍼를 모두 MAXLINE 배열로 스택에 두면 요청이 작아도
+ * 연결 하나가 140KB 가까운 스택을 잡는다. 대신 4KB/16KB 두 크기의 버퍼를 이 풀에서 빌려 쓰고
+ * 연결이 끝나면 돌려준다. growbuf_t는 작은 크기로 시작해 요청 줄이나 헤더가 정말 길 때만
+ * 큰 크기로, 그보다 크면 malloc으로 키운다.
+ *
+ * 크기마다 BUFPOOL_*_COUNT개짜리 영역을 mmap으로 예약해 두고(쓴 페이지만 메모리를 차지한다)
+ * 빈 버퍼는 인덱스 스택으로 락 없이 주고받는다. 스택 머리의 상위 32비트는 세대 번호라서
+ * pop과 push가 엇갈려도 ABA가 생기지 않는다. 영역이 다 차면 malloc으로 대신한다.
+ */
+#ifndef __BUFPOOL_H__
+#define __BUFPOOL_H__
+
+#include <stddef.h>
+
+#define BUFPOOL_SMALL (4 * 1024)
+#define BUFPOOL_LARGE (16 * 1024)
+#define BUFPOOL_SMALL_COUNT 4096 // 16MB 예약
+#define BUFPOOL_LARGE_COUNT 1024 // 16MB 예약
+
+/* 키울 수 있는 버퍼. {NULL, 0}으로 시작하고 growbuf_free로 돌려준다 */
+typedef struct
+{
+  char *ptr;
+  size_t size; // ptr의 크기
+} growbuf_t;
+
+int growbuf_reserve(growbuf_t *b, size_t need);
+void growbuf_free(growbuf_t *b);
+int bufpool_stats(char *buf, int size);
+
+#endif /* __BUFPOOL_H__ */
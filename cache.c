@@ -0,0 +1,1351 @@
+/*
+ * cache.c - 샤드로 나눈 해시 인덱스 + 샤드별 LRU 리스트로 구성된 웹 객체 캐시
+ *
+ * 쓰기(삽입, 제거, LRU 이동)는 샤드 락 아래에서 하고, 해시 체인은 release 저장으로 고쳐서
+ * cache_lookup이 락 없이 따라갈 수 있게 한다. 인덱스에서 뗀 객체는 바로 해제하지 않고
+ * 샤드의 보류 목록에 두었다가 에포크가 두 번 넘어가고 참조도 없을 때 해제한다.
+ */
+#include "cache.h"
+#include "disk.h"
+#include "snapshot.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  web_object_t *buckets[CACHE_BUCKETS];
+  web_object_t *rootp, *lastp; // 가장 최근 / 가장 오래전에 사용한 객체
+  size_t total_cache_size;     // 예산에 잡힌 바이트 (charge 합)
+  size_t objects;
+  size_t header_bytes, key_bytes, body_bytes; // 요청된 크기 기준 구성 요소별 바이트
+  size_t zombie_bytes;         // 캐시에서 빠졌지만 읽는 스레드가 남아 있을 수 있어 해제 못 한 바이트
+  unsigned long evictions, sync_evictions; // 전체 / 요청 스레드에서 한 제거
+  unsigned long expired, negative_hits, banned, purged;
+  size_t vary_indexes;
+  unsigned long variant_evictions; // 색인의 변형 수 제한으로 밀어낸 변형
+  unsigned char sketch[ADMIT_SKETCH_DEPTH][ADMIT_SKETCH_WIDTH]; // 요청 빈도 count-min 스케치
+  unsigned char door[ADMIT_DOOR_BITS / 8]; // 한 번 본 키 (처음 요청은 스케치에 넣지 않는다)
+  int sketch_adds;
+  unsigned long admitted, rejected;
+  web_object_t *wheel[2][EXPIRY_WHEEL_SLOTS]; // 만료 휠 (1초 칸 / EXPIRY_WHEEL_SLOTS초 칸)
+  time_t wheel_time;           // 아직 훑지 않은 첫 초. 이전 칸은 모두 비어 있다
+  time_t cascaded;             // 둘째 단 칸을 마지막으로 풀어 내린 시각
+  size_t timed;                // 휠에 걸린 객체 수
+  unsigned long expired_swept;
+  size_t expired_bytes;        // 만료로 회수한 바이트 (charge 기준, 조회 중 발견한 것 포함)
+  web_object_t *retired[3];    // 뗀 에포크 % 3별 보류 목록 (next로 연결)
+  size_t nretired, retired_bytes;
+  unsigned long reclaimed;
+} cache_shard_t;
+
+#define EVICT_WINDOW 60 // 제거 속도를 계산하는 구간(초)
+
+static cache_shard_t shards[CACHE_SHARDS];
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static int admission = 1; // 0이면 입장 필터 없이 모두 넣는다
+static int dedup = 1;     // 0이면 본문 풀을 쓰지 않는다
+
+/* 백그라운드 제거 스레드가 맡을 샤드 (비트마스크) */
+static pthread_mutex_t evictor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t evictor_cond = PTHREAD_COND_INITIALIZER;
+static unsigned evict_wanted;
+static int evictor_running;
+
+static pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER; // 에포크를 올리는 쪽끼리 직렬화
+static __thread unsigned short lookup_ticks[CACHE_SHARDS]; // 락 없는 적중을 스케치 노화에 모아서 반영
+
+/* 초 단위 제거 횟수 링 버퍼 */
+static pthread_mutex_t evict_rate_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t evict_sec[EVICT_WINDOW];
+static unsigned long evict_cnt[EVICT_WINDOW];
+
+static void cache_init(void)
+{
+  int i;
+  for (i = 0; i < CACHE_SHARDS; i++) {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    shards[i].wheel_time = time(NULL);
+  }
+}
+
+static cache_shard_t *shard_of(uint64_t hash)
+{
+  Pthread_once(&cache_once, cache_init);
+  return &shards[hash >> (64 - CACHE_SHARD_BITS)];
+}
+
+/* 키에 한 글자를 덧붙이면서 해시도 같이 갱신 */
+static void key_putc(cache_key_t *key, char c)
+{
+  if (key->len < MAXLINE - 1)
+    key->str[key->len++] = c;
+  key->hash = (key->hash ^ (unsigned char)c) * FNV_PRIME;
+}
+
+static void key_puts(cache_key_t *key, char *s)
+{
+  while (*s)
+    key_putc(key, *s++);
+}
+
+static int hexval(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = tolower(c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+/*
+ * normalize_pct - src[0, n)의 퍼센트 인코딩을 정규화해 dst에 쓴다.
+ * 예약되지 않은 문자(ALPHA / DIGIT / - . _ ~)는 디코딩하고, 나머지는 16진수를 대문자로 맞춘다.
+ */
+static void normalize_pct(char *dst, char *src, int n)
+{
+  int i, hi, lo;
+
+  for (i = 0; i < n; i++) {
+    if (src[i] == '%' && i + 2 < n && (hi = hexval(src[i + 1])) >= 0 &&
+        (lo = hexval(src[i + 2])) >= 0) {
+      int c = hi * 16 + lo;
+      if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~')
+        *dst++ = c;
+      else
+        dst += sprintf(dst, "%%%02X", c);
+      i += 2;
+    } else {
+      *dst++ = src[i];
+    }
+  }
+  *dst = '\0';
+}
+
+/*
+ * remove_dot_segments - RFC 3986 5.2.4 알고리즘으로 경로의 "."와 ".." 세그먼트를 제거.
+ * 출력은 입력보다 앞서지 않으므로 out과 in이 같은 버퍼여도 된다.
+ */
+static void remove_dot_segments(char *out, char *in)
+{
+  char *o = out;
+
+  while (*in) {
+    if (!strncmp(in, "../", 3))
+      in += 3;
+    else if (!strncmp(in, "./", 2))
+      in += 2;
+    else if (!strncmp(in, "/./", 3))
+      in += 2;
+    else if (!strcmp(in, "/."))
+      in[1] = '\0';
+    else if (!strncmp(in, "/../", 4) || !strcmp(in, "/..")) {
+      in += 3;
+      if (!*in)
+        *--in = '/';
+      while (o > out && *--o != '/') // 출력의 마지막 세그먼트 제거
+        ;
+    } else if (!strcmp(in, ".") || !strcmp(in, ".."))
+      in += strlen(in);
+    else {
+      do // 첫 세그먼트를 출력으로 옮김
+        *o++ = *in++;
+      while (*in && *in != '/');
+    }
+  }
+  *o = '\0';
+}
+
+/* 키 문자열을 끝내고, FNV-1a는 상위 비트가 끝 글자에 잘 섞이지 않으므로 샤드 선택 전에 한 번 더 섞는다 */
+static void key_finish(cache_key_t *key)
+{
+  key->str[key->len] = '\0';
+  key->hash ^= key->hash >> 33;
+  key->hash *= 0xff51afd7ed558ccdULL;
+  key->hash ^= key->hash >> 33;
+  key->hash *= 0xc4ceb9fe1a85ec53ULL;
+  key->hash ^= key->hash >> 33;
+}
+
+/*
+ * build_cache_key - 요청마다 한 번 정규화된 캐시 키와 해시를 만든다.
+ * 호스트는 소문자로, 기본 포트(80)는 생략, 퍼센트 인코딩은 정규화, 경로의 점 세그먼트는 제거.
+ */
+void build_cache_key(cache_key_t *key, char *hostname, char *port, char *path)
+{
+  char buf[MAXLINE]; // 경로와 쿼리를 차례로 정규화한다 (연결 스레드 스택이 작다)
+  char *q, *frag;
+  int path_len;
+
+  key->len = 0;
+  key->hash = FNV_OFFSET;
+
+  key_puts(key, "http://");
+  for (q = hostname; *q; q++)
+    key_putc(key, tolower(*q));
+  if (strcmp(port, "80") && port[0]) {
+    key_putc(key, ':');
+    key_puts(key, port);
+  }
+
+  // 경로와 쿼리를 나누고 프래그먼트는 버림
+  frag = strchr(path, '#');
+  q = strchr(path, '?');
+  if (q && frag && frag < q)
+    q = NULL;
+  path_len = q ? q - path : (frag ? frag - path : strlen(path));
+
+  normalize_pct(buf, path, path_len);
+  remove_dot_segments(buf, buf);
+  if (buf[0] != '/')
+    key_putc(key, '/');
+  key_puts(key, buf);
+
+  if (q) {
+    q++;
+    normalize_pct(buf, q, frag ? frag - q : strlen(q));
+    key_putc(key, '?');
+    key_puts(key, buf);
+  }
+  key_finish(key);
+}
+
+/*
+ * parse_vary - 응답의 Vary 헤더 값 하나를 names 목록(소문자, 쉼표로 구분)에 덧붙인다.
+ * Accept-Encoding은 원 서버에 보내지 않고 프록시가 따로 처리하므로 뺀다 (gzip.h).
+ * "*"이거나 목록이 VARY_NAMES_MAX를 넘으면 -1 (캐싱할 수 없다)
+ */
+int parse_vary(char *value, char *names)
+{
+  int len = strlen(names), n, i;
+
+  while (*(value += strspn(value, ", \t")) && (n = strcspn(value, ", \t\r\n"))) {
+    if (n == 1 && *value == '*')
+      return -1;
+    if (n != 15 || strncasecmp(value, "Accept-Encoding", 15)) {
+      if (len + n + 2 > VARY_NAMES_MAX)
+        return -1;
+      if (len)
+        names[len++] = ',';
+      for (i = 0; i < n; i++)
+        names[len++] = tolower(value[i]);
+      names[len] = '\0';
+    }
+    value += n;
+  }
+  return 0;
+}
+
+/*
+ * build_variant_key - 주 키 뒤에 names의 요청 헤더 값들을 VARY_KEY_SEP으로 이어 붙여 변형 키를
+ * 만든다. 값은 앞뒤 공백을 떼고 안쪽 공백을 하나로 줄이며, 같은 헤더가 여러 줄이면 쉼표로 잇는다.
+ * 해시의 샤드 비트는 주 키와 같게 맞춘다.
+ */
+void build_variant_key(cache_key_t *variant, cache_key_t *key, char *names, char *hdrs)
+{
+  uint64_t shard_bits = ~0ULL << (64 - CACHE_SHARD_BITS);
+  char *name = names, *line, *p;
+  int n, found, space;
+
+  variant->len = 0;
+  variant->hash = FNV_OFFSET;
+  key_puts(variant, key->str);
+  while (*name) {
+    n = strcspn(name, ",");
+    key_putc(variant, VARY_KEY_SEP);
+    found = 0;
+    for (line = hdrs; *line; line += strcspn(line, "\n") + (line[strcspn(line, "\n")] != '\0')) {
+      if (strncasecmp(line, name, n) || line[n] != ':')
+        continue;
+      if (found++)
+        key_putc(variant, ',');
+      p = line + n + 1;
+      p += strspn(p, " \t");
+      for (space = 0; *p && *p != '\r' && *p != '\n'; p++) {
+        if (*p == ' ' || *p == '\t') {
+          space = 1;
+          continue;
+        }
+        if (space)
+          key_putc(variant, ' ');
+        space = 0;
+        key_putc(variant, *p);
+      }
+    }
+    name += n + (name[n] == ',');
+  }
+  key_finish(variant);
+  variant->hash = (variant->hash & ~shard_bits) | (key->hash & shard_bits);
+}
+
+/* 샤드 LRU 리스트에서 객체를 뗀다. 샤드 락을 잡은 상태에서 호출 */
+static void lru_unlink(cache_shard_t *shard, web_object_t *web_object)
+{
+  if (web_object->prev)
+    web_object->prev->next = web_object->next;
+  else
+    shard->rootp = web_object->next;
+  if (web_object->next)
+    web_object->next->prev = web_object->prev;
+  else
+    shard->lastp = web_object->prev;
+  web_object->prev = web_object->next = NULL;
+}
+
+/* 객체를 LRU 리스트의 root로 넣는다. 샤드 락을 잡은 상태에서 호출 */
+static void lru_push(cache_shard_t *shard, web_object_t *web_object)
+{
+  web_object->prev = NULL;
+  web_object->next = shard->rootp;
+  if (shard->rootp)
+    shard->rootp->prev = web_object;
+  else
+    shard->lastp = web_object;
+  shard->rootp = web_object;
+}
+
+/* 객체를 만료 시각에 맞는 휠 칸에 건다. 샤드 락을 잡은 상태에서 호출 */
+static void wheel_insert(cache_shard_t *shard, web_object_t *web_object)
+{
+  time_t t = web_object->expires < shard->wheel_time ? shard->wheel_time : web_object->expires;
+  time_t delta = t - shard->wheel_time;
+  web_object_t **slot;
+
+  if (delta < EXPIRY_WHEEL_SLOTS)
+    slot = &shard->wheel[0][t & (EXPIRY_WHEEL_SLOTS - 1)];
+  else if (delta < EXPIRY_WHEEL_SLOTS * EXPIRY_WHEEL_SLOTS)
+    slot = &shard->wheel[1][(t >> EXPIRY_WHEEL_BITS) & (EXPIRY_WHEEL_SLOTS - 1)];
+  else // 휠 범위 밖: 가장 늦게 풀리는 칸에 두었다가 다시 건다
+    slot = &shard->wheel[1][((shard->wheel_time >> EXPIRY_WHEEL_BITS) + EXPIRY_WHEEL_SLOTS - 1) &
+                            (EXPIRY_WHEEL_SLOTS - 1)];
+
+  web_object->wpprev = slot;
+  if ((web_object->wnext = *slot))
+    (*slot)->wpprev = &web_object->wnext;
+  *slot = web_object;
+}
+
+static void wheel_unlink(web_object_t *web_object)
+{
+  if ((*web_object->wpprev = web_object->wnext))
+    web_object->wnext->wpprev = web_object->wpprev;
+  web_object->wnext = NULL;
+  web_object->wpprev = NULL;
+}
+
+/* 칸의 리스트를 통째로 떼어 wheel_time 기준으로 다시 건다 */
+static void wheel_rehang(cache_shard_t *shard, web_object_t **slot)
+{
+  web_object_t *web_object = *slot, *next;
+
+  *slot = NULL;
+  for (; web_object; web_object = next) {
+    next = web_object->wnext;
+    wheel_insert(shard, web_object);
+  }
+}
+
+/* 스케치 row번째 줄의 카운터 번호. 줄마다 해시의 다른 비트를 쓴다 */
+static int sketch_index(uint64_t hash, int row)
+{
+  return (hash >> (row * 10)) & (ADMIT_SKETCH_WIDTH - 1);
+}
+
+static int door_index(uint64_t hash)
+{
+  return (hash >> 40) & (ADMIT_DOOR_BITS - 1);
+}
+
+/*
+ * 스케치는 락 없는 조회에서도 갱신하므로 바이트 단위 relaxed 읽기/쓰기만 쓴다.
+ * 동시에 갱신하면 한쪽이 사라질 수 있지만 빈도 추정에는 문제가 되지 않는다.
+ */
+#define SK_LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define SK_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+/* 키의 요청 빈도 추정값 */
+static int sketch_estimate(cache_shard_t *shard, uint64_t hash)
+{
+  int row, c, min = ADMIT_COUNTER_MAX, door = door_index(hash);
+
+  for (row = 0; row < ADMIT_SKETCH_DEPTH; row++)
+    if ((c = SK_LOAD(&shard->sketch[row][sketch_index(hash, row)])) < min)
+      min = c;
+  return min + ((SK_LOAD(&shard->door[door / 8]) >> (door % 8)) & 1);
+}
+
+/* 요청 한 번을 기록한다. 처음 본 키는 doorkeeper에만 표시 (conservative update) */
+static void sketch_record(cache_shard_t *shard, uint64_t hash)
+{
+  int row, min, door = door_index(hash);
+  unsigned char *p, bits = SK_LOAD(&shard->door[door / 8]);
+
+  if (!(bits & (1 << (door % 8)))) {
+    SK_STORE(&shard->door[door / 8], bits | (1 << (door % 8)));
+  } else if ((min = sketch_estimate(shard, hash) - 1) < ADMIT_COUNTER_MAX) {
+    for (row = 0; row < ADMIT_SKETCH_DEPTH; row++)
+      if (SK_LOAD(p = &shard->sketch[row][sketch_index(hash, row)]) == min)
+        SK_STORE(p, min + 1);
+  }
+}
+
+/* 요청 n번이 기록됐다. ADMIT_SAMPLE번마다 오래된 빈도를 반으로 줄인다 */
+static void sketch_tick(cache_shard_t *shard, int n)
+{
+  int row, i, adds = SK_LOAD(&shard->sketch_adds) + n;
+
+  if (adds < ADMIT_SAMPLE) {
+    SK_STORE(&shard->sketch_adds, adds);
+    return;
+  }
+  SK_STORE(&shard->sketch_adds, 0);
+  for (row = 0; row < ADMIT_SKETCH_DEPTH; row++)
+    for (i = 0; i < ADMIT_SKETCH_WIDTH; i++)
+      SK_STORE(&shard->sketch[row][i], SK_LOAD(&shard->sketch[row][i]) >> 1);
+  for (i = 0; i < ADMIT_DOOR_BITS / 8; i++)
+    SK_STORE(&shard->door[i], 0);
+}
+
+static void sketch_add(cache_shard_t *shard, uint64_t hash)
+{
+  sketch_record(shard, hash);
+  sketch_tick(shard, 1);
+}
+
+/*
+ * LRU 끝에서 밀어낼 객체. 락 없는 적중은 LRU를 옮기지 못하고 referenced만 표시하므로,
+ * 표시된 객체는 한 번 더 기회를 주어 root로 올린다 (CLOCK). 샤드 락을 잡은 상태에서 호출
+ */
+static web_object_t *lru_victim(cache_shard_t *shard)
+{
+  web_object_t *victim;
+  size_t n = shard->objects;
+
+  while ((victim = shard->lastp) && n-- > 0 && SK_LOAD(&victim->referenced)) {
+    SK_STORE(&victim->referenced, 0);
+    lru_unlink(shard, victim);
+    lru_push(shard, victim);
+  }
+  return shard->lastp;
+}
+
+/* 샤드 사용량. 주인이 먼저 해제된 공유 본문(orphan)은 샤드마다 똑같이 나눠 더한다 */
+static size_t shard_usage(cache_shard_t *shard)
+{
+  return shard->total_cache_size + dedup_orphan_bytes() / CACHE_SHARDS;
+}
+
+/*
+ * 예산을 넘기게 되는 객체는 LRU 끝에서 밀려날 객체 각각보다 자주 요청됐을 때만 넣는다.
+ * 희생자마다 비교하므로 큰 객체 하나가 자주 쓰이는 작은 객체 여럿을 밀어내지 못한다.
+ */
+static int admit(cache_shard_t *shard, web_object_t *web_object)
+{
+  size_t need = shard_usage(shard) + web_object->charge;
+  web_object_t *victim;
+  int freq;
+
+  if (!admission || need <= CACHE_EVICT_HIGH)
+    return 1;
+  freq = sketch_estimate(shard, web_object->hash);
+  for (victim = shard->lastp; victim && need > CACHE_EVICT_HIGH; victim = victim->prev) {
+    if (sketch_estimate(shard, victim->hash) >= freq)
+      return 0;
+    need -= victim->charge;
+  }
+  return 1;
+}
+
+static void count_eviction(void)
+{
+  time_t now = time(NULL);
+  int slot = now % EVICT_WINDOW;
+
+  pthread_mutex_lock(&evict_rate_lock);
+  if (evict_sec[slot] != now) {
+    evict_sec[slot] = now;
+    evict_cnt[slot] = 0;
+  }
+  evict_cnt[slot]++;
+  pthread_mutex_unlock(&evict_rate_lock);
+}
+
+/* 샤드의 구성 요소별 카운터에 객체를 더하거나(sign = 1) 뺀다(sign = -1) */
+static void account(cache_shard_t *shard, web_object_t *web_object, int sign)
+{
+  shard->objects += sign;
+  shard->total_cache_size += sign * web_object->charge;
+  shard->header_bytes += sign * (long)sizeof(web_object_t);
+  shard->key_bytes += sign * (web_object->key_len + web_object->type_len + 2);
+  if (web_object->body_owner) // 다른 객체와 나눠 쓰는 본문은 주인만 센다
+    shard->body_bytes += sign * web_object->content_length;
+  shard->vary_indexes += sign * (web_object->vary == VARY_INDEX);
+}
+
+/* 보류가 끝난 객체를 해제한다. demote면 디스크 캐시로 넘긴다. 샤드 락을 잡은 상태에서 호출 */
+static void release_object(cache_shard_t *shard, web_object_t *web_object)
+{
+  shard->zombie_bytes -= web_object->charge;
+  if (web_object->demote && web_object->status == 200 && !web_object->ntags &&
+      web_object->encoding == OBJECT_IDENTITY && !web_object->vary)
+    disk_demote(web_object); // 디스크 캐시가 꺼져 있으면 바로 해제 (태그, 인코딩, Vary는 디스크에 남기지 않는다)
+  else
+    free_web_object(web_object); // 제거한 노드의 메모리 반환
+}
+
+/*
+ * 주인이 해제된 공유 본문을 이 객체가 넘겨받아 샤드 charge에 잡는다. 넘겨받았으면 1.
+ * 샤드 락을 잡은 상태에서 호출
+ */
+static int adopt_body(cache_shard_t *shard, web_object_t *web_object)
+{
+  int adopted;
+
+  if (!web_object->body || web_object->body_owner || !(adopted = dedup_adopt(web_object->body)))
+    return 0;
+  account(shard, web_object, -1);
+  web_object->charge += adopted;
+  web_object->body_owner = 1;
+  account(shard, web_object, 1);
+  return 1;
+}
+
+/* 색인 index의 변형 중 해시가 hash인 객체. 샤드 락을 잡은 상태에서 호출 */
+static web_object_t *find_variant(cache_shard_t *shard, web_object_t *index, uint64_t hash)
+{
+  web_object_t *current;
+
+  for (current = shard->buckets[hash & (CACHE_BUCKETS - 1)]; current; current = current->hnext) {
+    if (current->hash == hash && current->vary == VARY_VARIANT &&
+        current->key_len > index->key_len && current->key[index->key_len] == VARY_KEY_SEP &&
+        !memcmp(current->key, index->key, index->key_len))
+      break;
+  }
+  return current;
+}
+
+/*
+ * 해시 인덱스와 LRU에서 객체를 떼어 지금 에포크의 보류 목록에 넣는다. 락 없이 읽는 스레드가
+ * 아직 이 객체를 보고 있을 수 있으므로 해제는 cache_reclaim이 한다. Vary 색인이면 색인 없이는
+ * 찾을 수 없는 변형들도 함께 뗀다.
+ */
+static void evict(cache_shard_t *shard, web_object_t *web_object, int demote)
+{
+  web_object_t **pp = &shard->buckets[web_object->hash & (CACHE_BUCKETS - 1)], **list, *variant;
+  vary_index_t *index;
+  int i;
+
+  while (*pp && *pp != web_object)
+    pp = &(*pp)->hnext;
+  if (*pp)
+    __atomic_store_n(pp, web_object->hnext, __ATOMIC_RELEASE); // 떼어도 hnext는 그대로 둔다
+
+  lru_unlink(shard, web_object);
+  if (web_object->wpprev) {
+    wheel_unlink(web_object);
+    shard->timed--;
+  }
+  account(shard, web_object, -1);
+
+  __atomic_store_n(&web_object->evicted, 1, __ATOMIC_RELEASE); // L1은 락 없이 읽는다
+  web_object->demote = demote;
+  shard->zombie_bytes += web_object->charge;
+  // 떼어 낸 것이 보인 뒤에 에포크를 읽어야 한다 (store-load 순서, epoch_enter와 짝).
+  // 그렇지 않으면 e + 1에 들어온 스레드가 아직 이 객체를 찾는데 e로 보류될 수 있다
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  list = &shard->retired[epoch_current() % 3];
+  web_object->next = *list;
+  *list = web_object;
+  shard->nretired++;
+  shard->retired_bytes += web_object->charge;
+
+  if (web_object->vary == VARY_INDEX) {
+    index = OBJECT_VARY_INDEX(web_object);
+    for (i = 0; i < CACHE_MAX_VARIANTS; i++)
+      if (index->variants[i] && (variant = find_variant(shard, web_object, index->variants[i])))
+        evict(shard, variant, 0);
+  }
+}
+
+/* 요청 스레드에서 샤드 사용량이 limit 이하가 될 때까지 LRU 끝부터 제거. 샤드 락을 잡은 상태에서 호출 */
+static void evict_to(cache_shard_t *shard, size_t limit)
+{
+  while (shard_usage(shard) > limit && shard->lastp) {
+    evict(shard, lru_victim(shard), 1);
+    shard->evictions++;
+    shard->sync_evictions++;
+    count_eviction();
+  }
+}
+
+/* 샤드가 HIGH를 넘었으니 제거 스레드를 깨운다. 샤드 락 밖에서 호출 */
+static void wake_evictor(cache_shard_t *shard)
+{
+  pthread_mutex_lock(&evictor_lock);
+  evict_wanted |= 1u << (shard - shards);
+  pthread_cond_signal(&evictor_cond);
+  pthread_mutex_unlock(&evictor_lock);
+}
+
+/*
+ * cache_reclaim - 에포크를 올릴 수 있으면 올리고, 두 에포크 전에 뗀 객체를 해제한다.
+ * 아직 참조가 남은 객체는 마지막 참조를 돌려줄 때 해제된다. 다른 스레드가 하고 있으면 건너뛴다.
+ * 주인이 해제된 공유 본문은 샤드 사용량으로 넘어가므로, 그래서 HIGH를 넘은 샤드는 제거 스레드를 깨운다.
+ */
+void cache_reclaim(void)
+{
+  web_object_t *web_object, *next;
+  uint64_t e;
+  unsigned wake = 0;
+  int i;
+
+  Pthread_once(&cache_once, cache_init);
+  if (pthread_mutex_trylock(&reclaim_lock))
+    return;
+  if ((e = epoch_try_advance())) {
+    for (i = 0; i < CACHE_SHARDS; i++) {
+      cache_shard_t *shard = &shards[i];
+      pthread_mutex_lock(&shard->lock);
+      web_object = shard->retired[(e + 1) % 3]; // e - 2에 뗀 객체
+      shard->retired[(e + 1) % 3] = NULL;
+      for (; web_object; web_object = next) {
+        next = web_object->next;
+        shard->nretired--;
+        shard->retired_bytes -= web_object->charge;
+        shard->reclaimed++;
+        if (web_object->refcnt)
+          web_object->evicted = 2; // 사용 중: 마지막 참조가 해제한다
+        else
+          release_object(shard, web_object);
+      }
+      pthread_mutex_unlock(&shard->lock);
+    }
+    for (i = 0; i < CACHE_SHARDS; i++)
+      if (evictor_running && shard_usage(&shards[i]) > CACHE_EVICT_HIGH)
+        wake |= 1u << i;
+  }
+  pthread_mutex_unlock(&reclaim_lock);
+  for (i = 0; i < CACHE_SHARDS; i++)
+    if (wake & (1u << i))
+      wake_evictor(&shards[i]);
+}
+
+/*
+ * 샤드의 휠을 now까지 돌리며 만료된 객체를 최대 EXPIRY_SWEEP_BATCH개 지운다.
+ * 아직 지울 것이 남았으면 1. 락을 오래 잡지 않도록 호출자가 락 밖에서 다시 부른다.
+ */
+static int sweep_shard(cache_shard_t *shard, time_t now)
+{
+  web_object_t **slot;
+  int i, n = 0, more;
+
+  pthread_mutex_lock(&shard->lock);
+  // 시계가 휠 한 바퀴 넘게 건너뛰었으면 칸을 하나씩 도는 대신 전부 다시 건다
+  if (now - shard->wheel_time >= EXPIRY_WHEEL_SLOTS * EXPIRY_WHEEL_SLOTS) {
+    shard->wheel_time = now;
+    shard->cascaded = now;
+    for (i = 0; i < 2 * EXPIRY_WHEEL_SLOTS; i++)
+      wheel_rehang(shard, &shard->wheel[i / EXPIRY_WHEEL_SLOTS][i % EXPIRY_WHEEL_SLOTS]);
+  }
+
+  while (shard->wheel_time <= now && n < EXPIRY_SWEEP_BATCH) {
+    i = shard->wheel_time & (EXPIRY_WHEEL_SLOTS - 1);
+    if (!i && shard->cascaded != shard->wheel_time) { // 둘째 단의 칸 하나를 첫째 단으로 풀어 내린다
+      shard->cascaded = shard->wheel_time;
+      wheel_rehang(shard, &shard->wheel[1][(shard->wheel_time >> EXPIRY_WHEEL_BITS) &
+                                           (EXPIRY_WHEEL_SLOTS - 1)]);
+    }
+    slot = &shard->wheel[0][i];
+    while (*slot && n < EXPIRY_SWEEP_BATCH) {
+      shard->expired_swept++;
+      shard->expired_bytes += (*slot)->charge;
+      evict(shard, *slot, 0);
+      n++;
+    }
+    if (!*slot)
+      shard->wheel_time++;
+  }
+  more = shard->wheel_time <= now;
+  pthread_mutex_unlock(&shard->lock);
+  return more;
+}
+
+/*
+ * 주인이 해제된 공유 본문을 그 본문을 가리키는 객체가 넘겨받게 한다. 작은 객체의 적중은
+ * 대부분 락 없는 경로라 read_cache에서 넘겨받을 기회가 없으므로 매초 훑는다.
+ */
+static void adopt_orphans(cache_shard_t *shard)
+{
+  web_object_t *current;
+
+  pthread_mutex_lock(&shard->lock);
+  for (current = shard->rootp; current && dedup_orphan_bytes(); current = current->next)
+    adopt_body(shard, current);
+  pthread_mutex_unlock(&shard->lock);
+}
+
+static void *sweep_thread(void *vargp)
+{
+  int i;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    sleep(1);
+    for (i = 0; i < CACHE_SHARDS; i++) {
+      while (sweep_shard(&shards[i], time(NULL)))
+        ;
+      if (dedup_orphan_bytes())
+        adopt_orphans(&shards[i]);
+    }
+    cache_reclaim();
+  }
+  return NULL;
+}
+
+/* cache_start_sweeper - 만료된 객체를 조회를 기다리지 않고 매초 회수하는 스레드를 띄운다 */
+void cache_start_sweeper(void)
+{
+  pthread_t tid;
+
+  Pthread_once(&cache_once, cache_init);
+  Pthread_create(&tid, NULL, sweep_thread, NULL);
+}
+
+/* 샤드를 CACHE_EVICT_LOW까지 최대 CACHE_EVICT_BATCH개 비운다. 더 비울 것이 남았으면 1 */
+static int evict_batch(cache_shard_t *shard)
+{
+  int n = 0, more;
+
+  pthread_mutex_lock(&shard->lock);
+  while (shard_usage(shard) > CACHE_EVICT_LOW && shard->lastp && n++ < CACHE_EVICT_BATCH) {
+    evict(shard, lru_victim(shard), 1);
+    shard->evictions++;
+    count_eviction();
+  }
+  more = shard_usage(shard) > CACHE_EVICT_LOW && shard->lastp;
+  pthread_mutex_unlock(&shard->lock);
+  return more;
+}
+
+static void *evictor_thread(void *vargp)
+{
+  unsigned wanted;
+  int i;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    pthread_mutex_lock(&evictor_lock);
+    while (!evict_wanted)
+      pthread_cond_wait(&evictor_cond, &evictor_lock);
+    wanted = evict_wanted;
+    evict_wanted = 0;
+    pthread_mutex_unlock(&evictor_lock);
+
+    for (i = 0; i < CACHE_SHARDS; i++)
+      if (wanted & (1u << i))
+        while (evict_batch(&shards[i]))
+          cache_reclaim();
+    cache_reclaim();
+  }
+  return NULL;
+}
+
+/*
+ * cache_start_evictor - 워터마크 제거 스레드를 띄운다. 띄우지 않으면(cachebench 등)
+ * write_cache가 예산을 넘을 때마다 그 자리에서 제거한다.
+ */
+void cache_start_evictor(void)
+{
+  pthread_t tid;
+
+  Pthread_once(&cache_once, cache_init);
+  evictor_running = 1;
+  Pthread_create(&tid, NULL, evictor_thread, NULL);
+}
+
+/*
+ * alloc_web_object - 키와 Content-type을 붙인 헤더와 content_length 크기의 본문을
+ * slab에서 받아 캐시에 넣을 객체를 만든다. 본문은 호출자가 채운다. 실패하면 NULL.
+ */
+web_object_t *alloc_web_object(cache_key_t *key, char *content_type, int content_length)
+{
+  return alloc_tagged_object(key, content_type, content_length, NULL, 0);
+}
+
+/* alloc_tagged_object - alloc_web_object와 같고, Surrogate-Key 태그 id들을 헤더에 붙인다 */
+web_object_t *alloc_tagged_object(cache_key_t *key, char *content_type, int content_length,
+                                  uint32_t *tags, int ntags)
+{
+  int type_len = strlen(content_type);
+  size_t hdr_size;
+  web_object_t *web_object;
+
+  if (type_len > 255)
+    type_len = 255;
+  hdr_size = sizeof(web_object_t) + OBJECT_NAMES_SIZE(key->len, type_len) + ntags * sizeof(uint32_t);
+  if (!(web_object = slab_alloc(hdr_size)))
+    return NULL;
+  memset(web_object, 0, sizeof(web_object_t));
+  if (!(web_object->response_ptr = slab_alloc(content_length))) {
+    slab_free(web_object, hdr_size);
+    return NULL;
+  }
+
+  web_object->hash = key->hash;
+  web_object->status = 200;
+  web_object->cached_at = ban_now();
+  web_object->content_length = content_length;
+  web_object->identity_length = content_length;
+  web_object->charge = slab_chunk_size(hdr_size) + slab_chunk_size(content_length);
+  web_object->body_owner = 1;
+  web_object->key_len = key->len;
+  web_object->type_len = type_len;
+  web_object->ntags = ntags;
+  memcpy(web_object->key, key->str, key->len + 1);
+  memcpy(OBJECT_TYPE(web_object), content_type, type_len);
+  OBJECT_TYPE(web_object)[type_len] = '\0';
+  if (ntags)
+    memcpy(OBJECT_TAGS(web_object), tags, ntags * sizeof(uint32_t));
+  return web_object;
+}
+
+/* free_web_object - 캐시에 넣지 않은 객체의 헤더와 본문을 돌려준다 */
+void free_web_object(web_object_t *web_object)
+{
+  if (web_object->body)
+    dedup_put(web_object->body, web_object->body_owner);
+  else
+    slab_free(web_object->response_ptr, web_object->content_length);
+  slab_free(web_object, OBJECT_HDR_SIZE(web_object));
+}
+
+/* find_cache와 cache_peek의 본체. count면 요청 한 번으로 기록한다 */
+static web_object_t *find_object(cache_key_t *key, int count)
+{
+  cache_shard_t *shard = shard_of(key->hash);
+  web_object_t *current;
+
+  pthread_mutex_lock(&shard->lock);
+  if (count)
+    sketch_add(shard, key->hash);
+  for (current = shard->buckets[key->hash & (CACHE_BUCKETS - 1)]; current;
+       current = current->hnext) {
+    if (current->hash == key->hash && current->key_len == key->len &&
+        !memcmp(current->key, key->str, key->len)) {
+      if (current->expires && current->expires <= time(NULL)) {
+        shard->expired_bytes += current->charge;
+        evict(shard, current, 0);
+        shard->expired++;
+        current = NULL;
+        break;
+      }
+      if (ban_check(current->key, current->key_len, current->cached_at, OBJECT_TAGS(current),
+                    current->ntags)) {
+        evict(shard, current, 0);
+        shard->banned++;
+        current = NULL;
+        break;
+      }
+      current->refcnt++;
+      if (current->status != 200 && count)
+        shard->negative_hits++;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return current;
+}
+
+/*
+ * find_cache - 키에 해당하는 객체를 찾아 참조를 하나 늘려서 반환한다.
+ * 만료됐거나 캐싱 뒤에 발행된 밴에 걸린 객체는 그 자리에서 제거하고 미스로 처리한다.
+ * 사용이 끝나면 반드시 read_cache로 돌려줘야 한다.
+ */
+web_object_t *find_cache(cache_key_t *key)
+{
+  return find_object(key, 1);
+}
+
+/*
+ * cache_peek - find_cache와 같지만 요청으로 세지 않는다 (입장 필터 빈도에 영향 없음).
+ * 백그라운드 작업이 객체를 다시 읽을 때 쓰고, 다 쓰면 release_cache로 돌려준다.
+ */
+web_object_t *cache_peek(cache_key_t *key)
+{
+  return find_object(key, 0);
+}
+
+/*
+ * cache_lookup - 락 없이 키를 찾는다. epoch_enter와 epoch_leave 사이에서만 부르고, 돌려받은
+ * 객체도 그 안에서만 쓴다. 참조를 잡지 않으며 LRU 대신 referenced만 표시한다.
+ * 없거나, 만료·밴·네거티브 항목처럼 락 아래에서 처리할 것이면 NULL (호출자는 find_cache로).
+ */
+web_object_t *cache_lookup(cache_key_t *key)
+{
+  cache_shard_t *shard = shard_of(key->hash);
+  web_object_t *current;
+  int s = shard - shards;
+
+  for (current = __atomic_load_n(&shard->buckets[key->hash & (CACHE_BUCKETS - 1)], __ATOMIC_ACQUIRE);
+       current; current = __atomic_load_n(&current->hnext, __ATOMIC_ACQUIRE)) {
+    if (current->hash == key->hash && current->key_len == key->len &&
+        !memcmp(current->key, key->str, key->len))
+      break;
+  }
+  if (!current || current->status != 200 || (current->expires && current->expires <= time(NULL)) ||
+      ban_check(current->key, current->key_len, current->cached_at, OBJECT_TAGS(current),
+                current->ntags))
+    return NULL;
+
+  sketch_record(shard, key->hash);
+  if (++lookup_ticks[s] == 64) { // 공유 카운터는 64번에 한 번만 쓴다
+    sketch_tick(shard, 64);
+    lookup_ticks[s] = 0;
+  }
+  if (!SK_LOAD(&current->referenced))
+    SK_STORE(&current->referenced, 1);
+  return current;
+}
+
+/* 참조를 하나 돌려준다. promote면 LRU root로 올리고, orphan 본문이면 넘겨받는다 */
+static void put_object(web_object_t *web_object, int promote)
+{
+  cache_shard_t *shard = shard_of(web_object->hash);
+  int wake = 0;
+
+  pthread_mutex_lock(&shard->lock);
+  if (web_object->evicted) { // 사용 중에 캐시에서 빠진 객체
+    if (--web_object->refcnt == 0 && web_object->evicted == 2)
+      release_object(shard, web_object);
+    pthread_mutex_unlock(&shard->lock);
+    return;
+  }
+
+  if (promote && web_object != shard->rootp) { // 현재 노드가 이미 root면 변경 없음
+    lru_unlink(shard, web_object);
+    lru_push(shard, web_object);
+  }
+  if (promote && adopt_body(shard, web_object) && shard_usage(shard) > CACHE_EVICT_HIGH) {
+    if (evictor_running)
+      wake = 1;
+    else
+      evict_to(shard, CACHE_SHARD_SIZE); // 이 객체가 빠져도 참조를 잡고 있으므로 안전하다
+  }
+  web_object->refcnt--;
+  pthread_mutex_unlock(&shard->lock);
+  if (wake)
+    wake_evictor(shard);
+}
+
+/* cache_hold - 이미 참조를 잡고 있는 객체에 참조를 하나 더 건다 */
+void cache_hold(web_object_t *web_object)
+{
+  cache_shard_t *shard = shard_of(web_object->hash);
+
+  pthread_mutex_lock(&shard->lock);
+  web_object->refcnt++;
+  pthread_mutex_unlock(&shard->lock);
+}
+
+/*
+ * cache_hold_hot - 캐시에 남아 있고 스케치 추정 빈도가 min_freq 이상이면 참조를 하나 더
+ * 걸고 1을 반환
+ */
+int cache_hold_hot(web_object_t *web_object, int min_freq)
+{
+  cache_shard_t *shard = shard_of(web_object->hash);
+  int hot;
+
+  pthread_mutex_lock(&shard->lock);
+  if ((hot = !web_object->evicted && sketch_estimate(shard, web_object->hash) >= min_freq))
+    web_object->refcnt++;
+  pthread_mutex_unlock(&shard->lock);
+  return hot;
+}
+
+/*
+ * cache_touch - 캐시 밖(L1)에서 적중한 객체를 요청 한 번으로 기록하고 LRU root로 올린 뒤
+ * cache_hold로 건 참조를 돌려준다
+ */
+void cache_touch(web_object_t *web_object)
+{
+  cache_shard_t *shard = shard_of(web_object->hash);
+
+  pthread_mutex_lock(&shard->lock);
+  if (!web_object->evicted)
+    sketch_add(shard, web_object->hash);
+  pthread_mutex_unlock(&shard->lock);
+  read_cache(web_object);
+}
+
+/* read_cache - 사용이 끝난 객체를 LRU root로 올리고 참조를 돌려준다 */
+void read_cache(web_object_t *web_object)
+{
+  put_object(web_object, 1);
+}
+
+/* release_cache - LRU 순서는 건드리지 않고 참조만 돌려준다 */
+void release_cache(web_object_t *web_object)
+{
+  put_object(web_object, 0);
+}
+
+/*
+ * collect_cache - 캐시에 있는 모든 객체에 참조를 하나씩 걸어 배열로 돌려준다.
+ * 락은 샤드마다 포인터를 모으는 동안만 잡는다. 다 쓰면 객체마다 release_cache 후 배열을 free.
+ */
+web_object_t **collect_cache(int *count)
+{
+  web_object_t **objs = NULL, *current;
+  int i, n = 0, cap = 0;
+
+  Pthread_once(&cache_once, cache_init);
+  for (i = 0; i < CACHE_SHARDS; i++) {
+    pthread_mutex_lock(&shards[i].lock);
+    if (n + shards[i].objects > cap) {
+      cap = n + shards[i].objects;
+      objs = Realloc(objs, cap * sizeof(web_object_t *));
+    }
+    for (current = shards[i].rootp; current; current = current->next) {
+      current->refcnt++;
+      objs[n++] = current;
+    }
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+  *count = n;
+  return objs;
+}
+
+/* 본문을 본문 풀에 넣고 charge를 다시 계산한다. 아직 아무도 보지 않은 객체에만 호출 */
+static void intern_body(web_object_t *web_object)
+{
+  int body_charge;
+
+  if (!dedup || web_object->body)
+    return;
+  body_charge = dedup_intern(&web_object->response_ptr, web_object->content_length,
+                             &web_object->body);
+  web_object->body_owner = body_charge > 0;
+  web_object->charge = slab_chunk_size(OBJECT_HDR_SIZE(web_object)) + body_charge;
+}
+
+/* 버킷에서 web_object와 같은 키의 객체. 샤드 락을 잡은 상태에서 호출 */
+static web_object_t *bucket_find(web_object_t **bucket, web_object_t *web_object)
+{
+  web_object_t *current;
+
+  for (current = *bucket; current; current = current->hnext) {
+    if (current->hash == web_object->hash && current->key_len == web_object->key_len &&
+        !memcmp(current->key, web_object->key, web_object->key_len))
+      break;
+  }
+  return current;
+}
+
+/*
+ * 객체를 버킷과 LRU, 만료 휠에 건다. 호출자의 참조를 하나 잡아 두므로 다 쓰면 release_cache.
+ * 샤드 락을 잡은 상태에서 호출하고, 락은 unlock_inserted로 푼다.
+ */
+static void link_object(cache_shard_t *shard, web_object_t **bucket, web_object_t *web_object)
+{
+  // 제거 스레드가 따라잡지 못해 샤드 크기 예산을 초과한 경우 -> 사용한지 가장 오래된 객체부터 제거
+  evict_to(shard, CACHE_SHARD_SIZE - web_object->charge);
+  account(shard, web_object, 1);
+
+  web_object->refcnt = 1;
+  web_object->evicted = 0;
+  web_object->hnext = *bucket;
+  __atomic_store_n(bucket, web_object, __ATOMIC_RELEASE); // 객체를 다 채운 뒤에 락 없는 조회에 보인다
+  lru_push(shard, web_object);
+  if (web_object->expires) {
+    wheel_insert(shard, web_object);
+    shard->timed++;
+  }
+}
+
+/* 넣은 뒤 샤드 락을 풀고, 필요하면 제거 스레드를 깨우거나 보류 목록을 회수한다 */
+static void unlock_inserted(cache_shard_t *shard)
+{
+  int wake = evictor_running && shard_usage(shard) > CACHE_EVICT_HIGH;
+  int reclaim = shard->nretired >= CACHE_RECLAIM_BATCH || shard->retired_bytes >= CACHE_RECLAIM_BYTES;
+
+  pthread_mutex_unlock(&shard->lock);
+  if (wake)
+    wake_evictor(shard);
+  if (reclaim)
+    cache_reclaim();
+}
+
+/*
+ * write_cache - 객체를 해당 샤드에 넣고 1을 반환. 같은 키가 이미 있으면 교체한다.
+ * 본문은 먼저 본문 풀에 넣어서, 같은 본문이 이미 있으면 그것을 함께 쓰고 헤더만 charge에 잡는다.
+ * 공간은 보통 제거 스레드가 미리 비워 두고, 그래도 샤드 예산을 넘을 때만 사용한지 가장
+ * 오래된 객체부터 그 자리에서 제거한다. 입장 필터가 거절하면 객체를 해제하고 0을 반환하며,
+ * 이때 디스크와 스냅샷의 사본은 그대로 둔다.
+ */
+int write_cache(web_object_t *web_object)
+{
+  cache_shard_t *shard = shard_of(web_object->hash);
+  web_object_t **bucket = &shard->buckets[web_object->hash & (CACHE_BUCKETS - 1)];
+  web_object_t *current;
+
+  intern_body(web_object);
+  pthread_mutex_lock(&shard->lock);
+  current = bucket_find(bucket, web_object);
+
+  // 이미 있는 키의 갱신은 항상 받고, 새 키는 입장 필터를 거친다
+  if (!current && !admit(shard, web_object)) {
+    shard->rejected++;
+    pthread_mutex_unlock(&shard->lock);
+    free_web_object(web_object);
+    return 0;
+  }
+  if (current)
+    evict(shard, current, 0);
+  shard->admitted++;
+  link_object(shard, bucket, web_object); // 아래에서 키를 읽는 동안 제거되지 않도록 참조를 잡는다
+  unlock_inserted(shard);
+
+  // 더 새로운 객체가 들어왔으니 디스크와 스냅샷의 사본은 버린다
+  disk_invalidate(web_object->hash, web_object->key, web_object->key_len, web_object->cached_at);
+  snapshot_invalidate(web_object->hash, web_object->key, web_object->key_len);
+  release_cache(web_object);
+  return 1;
+}
+
+/*
+ * 색인에 변형의 해시를 기록한다. 이미 있으면 그대로, 칸이 다 찼으면 가장 먼저 넣은 변형을
+ * 밀어내고 그 칸을 쓴다. 샤드 락을 잡은 상태에서 호출
+ */
+static void index_variant(cache_shard_t *shard, web_object_t *index, uint64_t hash)
+{
+  vary_index_t *vi = OBJECT_VARY_INDEX(index);
+  web_object_t *victim;
+  int i;
+
+  for (i = 0; i < CACHE_MAX_VARIANTS; i++)
+    if (vi->variants[i] == hash)
+      return;
+  for (i = 0; i < CACHE_MAX_VARIANTS && vi->variants[i]; i++)
+    ;
+  if (i == CACHE_MAX_VARIANTS) {
+    i = vi->next;
+    vi->next = (i + 1) % CACHE_MAX_VARIANTS;
+    if ((victim = find_variant(shard, index, vi->variants[i]))) {
+      evict(shard, victim, 0);
+      shard->variant_evictions++;
+    }
+  }
+  vi->variants[i] = hash;
+}
+
+/*
+ * cache_write_variant - Vary 목록 names로 응답한 URL의 변형 web_object(build_variant_key로 만든
+ * 키)를 넣는다. 주 키 key에 같은 목록의 색인이 없으면 새로 만들어 그 자리의 객체를 바꾼다.
+ * web_object가 NULL이면 색인만 건다. 변형의 입장 필터와 반환값은 write_cache와 같다.
+ */
+int cache_write_variant(cache_key_t *key, char *names, web_object_t *web_object)
+{
+  cache_shard_t *shard = shard_of(key->hash);
+  web_object_t **bucket = &shard->buckets[key->hash & (CACHE_BUCKETS - 1)];
+  web_object_t *index, *current, *old, *linked = NULL, *rejected = NULL;
+  int names_len = strlen(names);
+
+  if (!(index = alloc_web_object(key, "", sizeof(vary_index_t) + names_len + 1))) {
+    if (web_object)
+      free_web_object(web_object);
+    return 0;
+  }
+  index->vary = VARY_INDEX;
+  memset(index->response_ptr, 0, sizeof(vary_index_t));
+  memcpy(OBJECT_VARY_INDEX(index)->names, names, names_len + 1);
+  if (web_object) {
+    web_object->vary = VARY_VARIANT;
+    intern_body(web_object);
+  }
+
+  pthread_mutex_lock(&shard->lock);
+  current = bucket_find(bucket, index);
+  // 같은 목록의 색인이 이미 있으면 그것을 쓰고, 아니면 그 자리의 객체(Vary 없이 넣은 예전
+  // 응답이나 목록이 다른 색인과 그 변형들)를 새 색인으로 바꾼다
+  if (!current || current->vary != VARY_INDEX || strcmp(OBJECT_VARY_INDEX(current)->names, names)) {
+    if (current)
+      evict(shard, current, 0);
+    link_object(shard, bucket, index);
+    linked = current = index;
+  }
+
+  if (web_object) {
+    bucket = &shard->buckets[web_object->hash & (CACHE_BUCKETS - 1)];
+    old = bucket_find(bucket, web_object);
+    if (!old && !admit(shard, web_object)) {
+      shard->rejected++;
+      rejected = web_object;
+    } else {
+      if (old)
+        evict(shard, old, 0);
+      index_variant(shard, current, web_object->hash);
+      shard->admitted++;
+      link_object(shard, bucket, web_object);
+    }
+  }
+  unlock_inserted(shard);
+
+  if (linked) {
+    disk_invalidate(linked->hash, linked->key, linked->key_len, linked->cached_at);
+    snapshot_invalidate(linked->hash, linked->key, linked->key_len);
+    release_cache(linked);
+  } else {
+    free_web_object(index);
+  }
+  if (rejected) {
+    free_web_object(rejected);
+    return 0;
+  }
+  if (web_object)
+    release_cache(web_object);
+  return 1;
+}
+
+/*
+ * cache_replace - 키의 현재 객체가 아직 old이면 web_object로 바꾸고 1을 반환한다.
+ * 그 사이 다른 객체로 바뀌었거나 빠졌으면 web_object를 해제하고 0. 같은 내용을 다른 형태로
+ * 다시 넣는 것이므로 입장 필터를 거치지 않고, 디스크와 스냅샷의 사본도 그대로 둔다.
+ */
+int cache_replace(web_object_t *old, web_object_t *web_object)
+{
+  cache_shard_t *shard = shard_of(web_object->hash);
+  web_object_t **bucket = &shard->buckets[web_object->hash & (CACHE_BUCKETS - 1)];
+
+  intern_body(web_object);
+  pthread_mutex_lock(&shard->lock);
+  if (bucket_find(bucket, web_object) != old) {
+    pthread_mutex_unlock(&shard->lock);
+    free_web_object(web_object);
+    return 0;
+  }
+  evict(shard, old, 0);
+  link_object(shard, bucket, web_object);
+  unlock_inserted(shard);
+  release_cache(web_object);
+  return 1;
+}
+
+/* purge_cache - 키에 해당하는 객체를 바로 지우고, 있었으면 1을 반환 */
+int purge_cache(cache_key_t *key)
+{
+  cache_shard_t *shard = shard_of(key->hash);
+  web_object_t *current;
+
+  pthread_mutex_lock(&shard->lock);
+  for (current = shard->buckets[key->hash & (CACHE_BUCKETS - 1)]; current;
+       current = current->hnext) {
+    if (current->hash == key->hash && current->key_len == key->len &&
+        !memcmp(current->key, key->str, key->len)) {
+      evict(shard, current, 0);
+      shard->purged++;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return current != NULL;
+}
+
+/* cache_set_admission - 입장 필터를 켜거나(기본) 끈다 */
+void cache_set_admission(int enabled)
+{
+  admission = enabled;
+}
+
+/* cache_set_dedup - 본문 중복 제거를 켜거나(기본) 끈다 */
+void cache_set_dedup(int enabled)
+{
+  dedup = enabled;
+}
+
+/*
+ * cache_stats - 객체 수, 구성 요소별 바이트, 제거 횟수와 최근 EVICT_WINDOW초 제거 속도,
+ * 만료 회수량을 buf에 텍스트로 쓰고 길이를 반환
+ */
+int cache_stats(char *buf, int size)
+{
+  size_t objects = 0, charged = 0, header = 0, key = 0, body = 0, zombie = 0;
+  size_t timed = 0, expired_bytes = 0, retired = 0;
+  unsigned long reclaimed = 0;
+  unsigned long expired_swept = 0, sync_evictions = 0;
+  unsigned long evictions = 0, recent = 0, admitted = 0, rejected = 0, expired = 0, negative = 0;
+  unsigned long banned = 0, purged = 0, variant_evictions = 0;
+  size_t vary_indexes = 0;
+  time_t now = time(NULL);
+  int i, len;
+
+  Pthread_once(&cache_once, cache_init);
+  for (i = 0; i < CACHE_SHARDS; i++) {
+    pthread_mutex_lock(&shards[i].lock);
+    objects += shards[i].objects;
+    charged += shards[i].total_cache_size;
+    header += shards[i].header_bytes;
+    key += shards[i].key_bytes;
+    body += shards[i].body_bytes;
+    zombie += shards[i].zombie_bytes;
+    evictions += shards[i].evictions;
+    sync_evictions += shards[i].sync_evictions;
+    admitted += shards[i].admitted;
+    rejected += shards[i].rejected;
+    expired += shards[i].expired;
+    negative += shards[i].negative_hits;
+    banned += shards[i].banned;
+    purged += shards[i].purged;
+    vary_indexes += shards[i].vary_indexes;
+    variant_evictions += shards[i].variant_evictions;
+    timed += shards[i].timed;
+    expired_swept += shards[i].expired_swept;
+    expired_bytes += shards[i].expired_bytes;
+    retired += shards[i].nretired;
+    reclaimed += shards[i].reclaimed;
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+
+  pthread_mutex_lock(&evict_rate_lock);
+  for (i = 0; i < EVICT_WINDOW; i++)
+    if (now - evict_sec[i] < EVICT_WINDOW)
+      recent += evict_cnt[i];
+  pthread_mutex_unlock(&evict_rate_lock);
+
+  len = snprintf(buf, size,
+                 "cache_objects %zu\n"
+                 "cache_budget_bytes %d\n"
+                 "cache_used_bytes %zu\n"
+                 "cache_header_bytes %zu\n"
+                 "cache_key_bytes %zu\n"
+                 "cache_body_bytes %zu\n"
+                 "cache_index_bytes %zu\n"
+                 "cache_alloc_overhead_bytes %zu\n"
+                 "cache_pending_free_bytes %zu\n"
+                 "cache_evictions %lu\n"
+                 "cache_sync_evictions %lu\n"
+                 "cache_eviction_rate %.2f/s\n"
+                 "cache_admitted %lu\n"
+                 "cache_rejected %lu\n"
+                 "cache_expired %lu\n"
+                 "cache_expired_swept %lu\n"
+                 "cache_expired_bytes %zu\n"
+                 "cache_expiry_pending %zu\n"
+                 "cache_negative_hits %lu\n"
+                 "cache_banned %lu\n"
+                 "cache_purged %lu\n"
+                 "cache_vary_indexes %zu\n"
+                 "cache_variant_evictions %lu\n"
+                 "cache_epoch %lu\n"
+                 "cache_retired_objects %zu\n"
+                 "cache_reclaimed %lu\n",
+                 objects, MAX_CACHE_SIZE, charged + dedup_orphan_bytes() + CACHE_INDEX_SIZE, header, key, body,
+                 CACHE_INDEX_SIZE, charged - header - key - body, zombie, evictions, sync_evictions,
+                 (double)recent / EVICT_WINDOW, admitted, rejected,
+                 expired, expired_swept, expired_bytes, timed, negative, banned, purged,
+                 vary_indexes, variant_evictions,
+                 (unsigned long)epoch_current(), retired, reclaimed);
+  return len < size ? len : size;
+}
@@ -0,0 +1,167 @@
+/*
+ * cache.h - 프록시 웹 객체 캐시
+ *
+ * 캐시 키는 요청마다 한 번 만들어지는 정규화된 URL(scheme://host[:port]/path)이고,
+ * 키를 만들면서 함께 계산한 64비트 해시로 샤드, 해시 버킷, 진행 중 요청 묶기를 모두 정한다.
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdint.h>
+#include "csapp.h"
+#include "slab.h"
+#include "ban.h"
+#include "epoch.h"
+#include "dedup.h"
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+/* 샤드마다 락, 해시 버킷, LRU 리스트, 크기 예산을 따로 가진다 */
+#define CACHE_SHARD_BITS 2
+#define CACHE_SHARDS (1 << CACHE_SHARD_BITS)
+#define CACHE_BUCKETS 1024 // 샤드당 해시 버킷 수 (2의 거듭제곱)
+
+/*
+ * TinyLFU 입장 필터: 샤드마다 4줄 count-min 스케치와 doorkeeper 블룸 필터로 키별 요청 빈도를
+ * 추정하고, 예산이 찰 때는 밀려날 객체들보다 자주 요청된 객체만 새로 넣는다.
+ * 스케치에 ADMIT_SAMPLE번 더할 때마다 카운터를 반으로 줄이고 doorkeeper를 비운다.
+ */
+#define ADMIT_SKETCH_DEPTH 4
+#define ADMIT_SKETCH_WIDTH 1024 // 줄당 카운터 수 (2의 거듭제곱)
+#define ADMIT_COUNTER_MAX 15
+#define ADMIT_DOOR_BITS 8192    // 2의 거듭제곱
+#define ADMIT_SAMPLE (ADMIT_SKETCH_WIDTH * 10)
+#define ADMIT_SKETCH_SIZE (ADMIT_SKETCH_DEPTH * ADMIT_SKETCH_WIDTH + ADMIT_DOOR_BITS / 8)
+
+/*
+ * 만료 시각이 있는 객체는 샤드마다 2단 타이밍 휠(1초 칸 256개, 256초 칸 256개, 약 18시간)에
+ * 걸어 두고, 백그라운드 스레드가 매초 지난 칸을 훑어 락을 한 번 잡을 때 EXPIRY_SWEEP_BATCH개씩만
+ * 지운다. 더 먼 만료 시각은 둘째 단의 마지막 칸에 넣었다가 그 칸이 돌아올 때 다시 건다.
+ */
+#define EXPIRY_WHEEL_BITS 8
+#define EXPIRY_WHEEL_SLOTS (1 << EXPIRY_WHEEL_BITS)
+#define EXPIRY_WHEEL_SIZE (2 * EXPIRY_WHEEL_SLOTS * sizeof(void *))
+#define EXPIRY_SWEEP_BATCH 64
+
+/*
+ * 예산에는 본문뿐 아니라 헤더, 키, 해시 인덱스와 스케치, 만료 휠, 본문 풀의 인덱스,
+ * slab 청크의 내부 단편화까지 포함한다
+ */
+#define CACHE_INDEX_SIZE                                                                         \
+  (CACHE_SHARDS * (CACHE_BUCKETS * sizeof(void *) + ADMIT_SKETCH_SIZE + EXPIRY_WHEEL_SIZE) + \
+   DEDUP_INDEX_SIZE)
+#define CACHE_SHARD_SIZE ((MAX_CACHE_SIZE - CACHE_INDEX_SIZE) / CACHE_SHARDS)
+
+/*
+ * 샤드 사용량이 HIGH를 넘으면 백그라운드 제거 스레드가 LOW까지 LRU 끝부터 비워 두어,
+ * 요청 스레드는 보통 남은 공간에 넣기만 한다. 그래도 CACHE_SHARD_SIZE를 넘게 되는 삽입만
+ * 그 자리에서 제거한다. 입장 필터는 HIGH를 넘기는 새 객체에 적용한다.
+ */
+#define CACHE_EVICT_HIGH (CACHE_SHARD_SIZE / 100 * 90)
+#define CACHE_EVICT_LOW (CACHE_SHARD_SIZE / 100 * 70)
+#define CACHE_EVICT_BATCH 32 // 제거 스레드가 락을 한 번 잡을 때 지우는 최대 객체 수
+/* 샤드에 보류된 객체가 이만큼 쌓이면 write_cache가 회수를 시도한다 */
+#define CACHE_RECLAIM_BATCH 64
+#define CACHE_RECLAIM_BYTES (CACHE_SHARD_SIZE / 8)
+
+typedef struct
+{
+  char str[MAXLINE]; // 정규화된 키 문자열
+  int len;
+  uint64_t hash;     // str의 FNV-1a 64비트 해시 (+ 최종 섞기)
+} cache_key_t;
+
+/*
+ * 원 서버가 Vary로 응답한 URL은 주 키에 Vary 색인 객체만 두고, 응답은 주 키 뒤에 그 요청
+ * 헤더 값들을 붙인 변형 키에 넣는다. 변형 키의 해시는 주 키와 같은 샤드를 가리키므로 색인과
+ * 변형은 한 샤드 락 아래에서 관리되고, 색인이 빠지면 그 변형들도 함께 빠진다.
+ * Vary가 없는 URL은 지금처럼 주 키 한 번으로 찾는다.
+ */
+#define CACHE_MAX_VARIANTS 8 // 색인마다 둘 변형 수. 넘치면 가장 먼저 넣은 변형을 밀어낸다
+#define VARY_NAMES_MAX 256   // 정규화한 Vary 헤더 이름 목록의 최대 길이
+#define VARY_KEY_SEP '\x1f'  // 변형 키에서 주 키와 헤더 값들을 나누는 문자
+
+typedef struct
+{
+  uint64_t variants[CACHE_MAX_VARIANTS]; // 변형 객체의 해시 (0이면 빈 칸)
+  int next;                              // 칸이 다 찼을 때 다음에 비울 칸
+  char names[];                          // 소문자 헤더 이름들 ("accept-language,cookie")
+} vary_index_t;
+
+/*
+ * 캐시 엔트리 헤더. 키와 Content-type은 헤더 뒤에 실제 길이만큼 붙여 저장하고
+ * (Surrogate-Key 태그가 있으면 그 뒤에 4바이트 정렬로 태그 id들),
+ * 헤더와 본문은 모두 slab 할당기에서 받는다. 1KB 이상의 본문은 write_cache가 본문 풀에
+ * 넣으므로 다른 키의 객체와 같은 본문을 가리킬 수 있다 (본문은 캐시에 넣은 뒤 바뀌지 않는다).
+ */
+typedef struct web_object_t
+{
+  struct web_object_t *prev, *next; // 샤드 LRU 리스트
+  struct web_object_t *hnext;       // 해시 버킷 체인
+  struct web_object_t *wnext, **wpprev; // 만료 휠 칸의 리스트 (expires가 있을 때만)
+  uint64_t hash;
+  char *response_ptr;
+  dedup_body_t *body;     // 본문 풀의 본문 (풀에 넣지 않았으면 NULL)
+  int content_length;     // 저장된 본문 길이 (gzip이면 압축된 길이)
+  int identity_length;    // gzip이면 압축을 푼 본문 길이
+  int charge;             // 예산에 잡히는 바이트 (헤더 + 본문 slab 청크 크기)
+  int refcnt;             // find_cache로 빌려 간 스레드 수
+  time_t expires;         // 이 시각 이후에는 미스로 취급 (0이면 만료 없음)
+  uint64_t cached_at;     // 원 서버에서 받은 시각 (µs). 이후에 발행된 밴만 적용된다
+  unsigned short status;  // 200이 아니면 본문에 상태 줄부터 응답 전체가 들어 있는 네거티브 항목
+  unsigned short key_len; // key의 길이 ('\0' 제외)
+  unsigned char type_len; // content_type의 길이 ('\0' 제외)
+  unsigned char evicted;  // 캐시에서 빠짐: 1이면 에포크 보류 중, 2면 마지막 참조가 해제
+  unsigned char demote;   // 보류가 끝나면 디스크 캐시로 넘긴다
+  unsigned char referenced; // 락 없는 적중이 있었음 (제거할 때 한 번 더 기회를 준다)
+  unsigned char ntags;    // Surrogate-Key 태그 수
+  unsigned char body_owner; // 본문 값이 이 객체의 charge에 잡혀 있다
+  unsigned char encoding; // OBJECT_IDENTITY 또는 OBJECT_GZIP
+  unsigned char vary;     // VARY_INDEX면 본문이 vary_index_t, VARY_VARIANT면 변형 키로 넣은 응답
+  char key[];             // key '\0' content_type '\0' [태그 id들]
+} web_object_t;
+
+/* 저장된 본문의 Content-Encoding */
+#define OBJECT_IDENTITY 0
+#define OBJECT_GZIP 1
+
+#define VARY_INDEX 1
+#define VARY_VARIANT 2
+#define OBJECT_VARY_INDEX(o) ((vary_index_t *)(o)->response_ptr)
+
+#define OBJECT_TYPE(o) ((o)->key + (o)->key_len + 1)
+#define OBJECT_NAMES_SIZE(key_len, type_len) (((key_len) + (type_len) + 2 + 3) & ~3)
+#define OBJECT_TAGS(o) ((uint32_t *)((o)->key + OBJECT_NAMES_SIZE((o)->key_len, (o)->type_len)))
+#define OBJECT_HDR_SIZE(o) \
+  (sizeof(web_object_t) + OBJECT_NAMES_SIZE((o)->key_len, (o)->type_len) + (o)->ntags * sizeof(uint32_t))
+
+void build_cache_key(cache_key_t *key, char *hostname, char *port, char *path);
+int parse_vary(char *value, char *names);
+void build_variant_key(cache_key_t *variant, cache_key_t *key, char *names, char *hdrs);
+web_object_t *alloc_web_object(cache_key_t *key, char *content_type, int content_length);
+web_object_t *alloc_tagged_object(cache_key_t *key, char *content_type, int content_length,
+                                  uint32_t *tags, int ntags);
+void free_web_object(web_object_t *web_object);
+web_object_t *find_cache(cache_key_t *key);
+web_object_t *cache_peek(cache_key_t *key);
+web_object_t *cache_lookup(cache_key_t *key);
+void cache_reclaim(void);
+void read_cache(web_object_t *web_object);
+int write_cache(web_object_t *web_object);
+int cache_write_variant(cache_key_t *key, char *names, web_object_t *web_object);
+int cache_replace(web_object_t *old, web_object_t *web_object);
+int purge_cache(cache_key_t *key);
+void cache_set_admission(int enabled);
+void cache_set_dedup(int enabled);
+void cache_start_sweeper(void);
+void cache_start_evictor(void);
+void release_cache(web_object_t *web_object);
+void cache_hold(web_object_t *web_object);
+int cache_hold_hot(web_object_t *web_object, int min_freq);
+void cache_touch(web_object_t *web_object);
+web_object_t **collect_cache(int *count);
+int cache_stats(char *buf, int size);
+
+#endif /* __CACHE_H__ */
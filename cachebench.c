@@ -0,0 +1,283 @@
+/*
+ * cachebench.c - 합성 요청열로 캐시 적중률을 재는 도구
+ *
+ * Zipf 분포로 반복 요청되는 객체들 사이에 한 번만 요청되는 URL(크롤러 스캔)을 섞어
+ * 프록시와 같은 순서(find_cache → 미스면 alloc_web_object + write_cache)로 캐시를 돌린다.
+ *
+ *   usage: cachebench [-AU] [-n requests] [-k hot_keys] [-z zipf_s] [-s scan_fraction]
+ *                     [-D dup_fraction]
+ *          cachebench -t max_threads [-d seconds]
+ *     -A  입장 필터 끄기
+ *     -U  본문 중복 제거 끄기
+ *     -D  반복 요청되는 키 중 이 비율은 DUP_BODIES개 본문 중 하나를 다른 URL로 받는다 (본문 중복 제거 측정)
+ *     -t  적중률 대신 1, 2, 4, ... max_threads 스레드에서 적중 처리량을 잰다. 읽기 방식은
+ *         mutex(전역 락 하나), refcount(샤드 락 + 참조 수, find_cache/read_cache),
+ *         epoch(락 없는 cache_lookup) 세 가지
+ */
+#include "cache.h"
+
+#define TP_KEYS 256        // 처리량 측정에 쓰는 객체 수 (모두 캐시에 들어간다)
+#define TP_OBJECT_SIZE 1024
+#define DUP_BODIES 16      // -D로 여러 URL이 나눠 쓰는 본문 수
+
+enum { TP_MUTEX, TP_REFCOUNT, TP_EPOCH, TP_MODES };
+static const char *tp_names[TP_MODES] = { "mutex", "refcount", "epoch" };
+
+static cache_key_t tp_keys[TP_KEYS];
+static pthread_mutex_t tp_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int tp_go, tp_stop;
+
+typedef struct
+{
+  int mode;
+  uint64_t seed;
+  unsigned long ops;
+  char pad[64];
+} tp_worker_t;
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static double rng_unit(void)
+{
+  return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* id마다 고정된 본문 크기: 512B ~ 32KB 로그 균등 분포 */
+static int object_size(uint64_t id)
+{
+  uint64_t h = id * 0x9e3779b97f4a7c15ULL;
+  return (int)(512.0 * pow(64.0, (h >> 11) * (1.0 / 9007199254740992.0)));
+}
+
+/* 내용 id로 정해지는 본문. 내용 id가 다르면 본문도 다르다 */
+static void fill_body(char *body, int size, uint64_t cid)
+{
+  memset(body, 'a' + cid % 26, size);
+  memcpy(body, &cid, sizeof(cid));
+}
+
+/* 본문을 전송 버퍼로 복사하는 것으로 send를 흉내 낸다 */
+static void tp_send(web_object_t *web_object, char *out)
+{
+  memcpy(out, web_object->response_ptr, web_object->content_length);
+}
+
+static void *tp_thread(void *vargp)
+{
+  tp_worker_t *w = vargp;
+  web_object_t *web_object;
+  char out[TP_OBJECT_SIZE];
+  unsigned long ops = 0;
+  uint64_t x = w->seed;
+
+  while (!tp_go)
+    ;
+  while (!tp_stop) {
+    cache_key_t *key;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    key = &tp_keys[x % TP_KEYS];
+
+    switch (w->mode) {
+    case TP_MUTEX: // 전역 락을 잡은 채로 찾고 보낸다 (샤드가 없던 시절의 방식)
+      pthread_mutex_lock(&tp_lock);
+      if ((web_object = cache_lookup(key)))
+        tp_send(web_object, out);
+      pthread_mutex_unlock(&tp_lock);
+      break;
+    case TP_REFCOUNT:
+      if ((web_object = find_cache(key))) {
+        tp_send(web_object, out);
+        read_cache(web_object);
+      }
+      break;
+    case TP_EPOCH:
+      if (epoch_enter()) {
+        if ((web_object = cache_lookup(key)))
+          tp_send(web_object, out);
+        epoch_leave();
+      }
+      break;
+    }
+    ops++;
+  }
+  w->ops = ops;
+  return NULL;
+}
+
+/* threads개 스레드로 seconds초 동안 mode 방식 적중을 돌리고 초당 처리량을 반환 */
+static double tp_run(int mode, int threads, double seconds)
+{
+  tp_worker_t *workers = Calloc(threads, sizeof(tp_worker_t));
+  pthread_t *tids = Malloc(threads * sizeof(pthread_t));
+  unsigned long total = 0;
+  int i;
+
+  tp_go = tp_stop = 0;
+  for (i = 0; i < threads; i++) {
+    workers[i].mode = mode;
+    workers[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+    Pthread_create(&tids[i], NULL, tp_thread, &workers[i]);
+  }
+  tp_go = 1;
+  usleep(seconds * 1e6);
+  tp_stop = 1;
+  for (i = 0; i < threads; i++) {
+    Pthread_join(tids[i], NULL);
+    total += workers[i].ops;
+  }
+  free(workers);
+  free(tids);
+  return total / seconds;
+}
+
+static void throughput(int max_threads, double seconds)
+{
+  web_object_t *web_object;
+  char path[64];
+  int i, t, mode;
+
+  cache_set_admission(0);
+  for (i = 0; i < TP_KEYS; i++) {
+    sprintf(path, "/tp/%d", i);
+    build_cache_key(&tp_keys[i], "bench", "80", path);
+    if ((web_object = alloc_web_object(&tp_keys[i], "text/plain", TP_OBJECT_SIZE))) {
+      memset(web_object->response_ptr, 'x', TP_OBJECT_SIZE);
+      write_cache(web_object);
+    }
+  }
+
+  printf("hit throughput (Mops/s), %d x %dB objects, %.1fs per point\n", TP_KEYS, TP_OBJECT_SIZE,
+         seconds);
+  printf("%8s", "threads");
+  for (mode = 0; mode < TP_MODES; mode++)
+    printf(" %10s", tp_names[mode]);
+  printf("\n");
+  for (t = 1; t <= max_threads; t *= 2) {
+    printf("%8d", t);
+    for (mode = 0; mode < TP_MODES; mode++)
+      printf(" %10.2f", tp_run(mode, t, seconds) / 1e6);
+    printf("\n");
+    fflush(stdout);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  long requests = 1000000, i, hits = 0, hot_requests = 0, hot_hits = 0;
+  int keys = 5000, opt, lo, hi, mid, threads = 0;
+  double zipf_s = 0.9, scan = 0.5, dup = 0, *cdf, sum = 0, seconds = 1;
+  unsigned long long bytes = 0, hit_bytes = 0;
+  char path[64], *type = "text/plain", stats[MAXBUF];
+  cache_key_t key;
+
+  while ((opt = getopt(argc, argv, "AUn:k:z:s:D:t:d:")) != -1) {
+    switch (opt) {
+    case 'A':
+      cache_set_admission(0);
+      break;
+    case 'U':
+      cache_set_dedup(0);
+      break;
+    case 'n':
+      requests = atol(optarg);
+      break;
+    case 'k':
+      keys = atoi(optarg);
+      break;
+    case 'z':
+      zipf_s = atof(optarg);
+      break;
+    case 's':
+      scan = atof(optarg);
+      break;
+    case 'D':
+      dup = atof(optarg);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'd':
+      seconds = atof(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-AU] [-n requests] [-k hot_keys] [-z zipf_s] [-s scan_fraction]\n"
+                      "       %*s [-D dup_fraction]\n"
+                      "       %s -t max_threads [-d seconds]\n",
+              argv[0], (int)strlen(argv[0]), "", argv[0]);
+      exit(1);
+    }
+  }
+
+  if (threads > 0) {
+    throughput(threads, seconds);
+    return 0;
+  }
+
+  cdf = Malloc(keys * sizeof(double));
+  for (i = 0; i < keys; i++)
+    cdf[i] = (sum += 1.0 / pow(i + 1, zipf_s));
+  for (i = 0; i < keys; i++)
+    cdf[i] /= sum;
+
+  for (i = 0; i < requests; i++) {
+    uint64_t id, cid;
+    int hot = rng_unit() >= scan, size;
+
+    if (hot) {
+      double u = rng_unit();
+      for (lo = 0, hi = keys - 1; lo < hi;) {
+        mid = (lo + hi) / 2;
+        if (cdf[mid] < u)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      id = lo;
+      sprintf(path, "/hot/%lu", (unsigned long)id);
+    } else {
+      id = keys + i; // 한 번만 요청되는 URL
+      sprintf(path, "/scan/%ld", i);
+    }
+    // 중복 본문을 받는 키인지는 키마다 고정이다
+    cid = hot && (id * 0xbf58476d1ce4e5b9ULL >> 11) * (1.0 / 9007199254740992.0) < dup
+              ? ~(uint64_t)(id % DUP_BODIES)
+              : id;
+    size = object_size(cid);
+    build_cache_key(&key, "bench", "80", path);
+
+    web_object_t *web_object = find_cache(&key);
+    bytes += size;
+    hot_requests += hot;
+    if (web_object) {
+      hits++;
+      hot_hits += hot;
+      hit_bytes += size;
+      read_cache(web_object);
+    } else if (size <= MAX_OBJECT_SIZE && (web_object = alloc_web_object(&key, type, size))) {
+      fill_body(web_object->response_ptr, size, cid);
+      write_cache(web_object);
+    }
+  }
+
+  printf("requests %ld (scan %.0f%%, %d hot keys, zipf s=%.2f, dup %.0f%%)\n", requests, scan * 100,
+         keys, zipf_s, dup * 100);
+  printf("hit_ratio %.4f\n", (double)hits / requests);
+  printf("hot_hit_ratio %.4f\n", hot_requests ? (double)hot_hits / hot_requests : 0.0);
+  printf("byte_hit_ratio %.4f\n", bytes ? (double)hit_bytes / bytes : 0.0);
+  cache_stats(stats, sizeof(stats));
+  fputs(stats, stdout);
+  dedup_stats(stats, sizeof(stats));
+  fputs(stats, stdout);
+  free(cdf);
+  return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * dedup.c - 내용 주소 본문 풀
+ *
+ * 본문과 그 기록은 slab에서 받는다. 풀은 해시 상위 비트로 나눈 줄무늬(stripe)마다 락과
+ * 버킷을 따로 두어, 서로 다른 샤드의 write_cache가 같은 락을 오래 다투지 않게 한다.
+ */
+#include "dedup.h"
+#include "slab.h"
+
+struct dedup_body_t
+{
+  uint64_t hash;
+  char *data;
+  int len;
+  int refs;                  // 이 본문을 가리키는 객체 수
+  int orphan;                // 주인이 해제돼 dedup_orphan_bytes에 잡혀 있다
+  struct dedup_body_t *next; // 버킷 체인
+};
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  dedup_body_t *buckets[DEDUP_BUCKETS];
+  size_t bodies, refs, saved_bytes;
+  unsigned long hits;
+} __attribute__((aligned(64))) dedup_stripe_t;
+
+static dedup_stripe_t stripes[DEDUP_STRIPES];
+static pthread_once_t dedup_once = PTHREAD_ONCE_INIT;
+static size_t orphan_bytes;
+
+static void dedup_init(void)
+{
+  int i;
+
+  for (i = 0; i < DEDUP_STRIPES; i++)
+    pthread_mutex_init(&stripes[i].lock, NULL);
+}
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+/* 본문의 64비트 해시. 8바이트씩 곱해 섞고 끝에 murmur3 finalizer로 한 번 더 섞는다 */
+static uint64_t body_hash(char *p, int len)
+{
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ ((uint64_t)len * 0xc2b2ae3d27d4eb4fULL), w;
+
+  for (; len >= 8; p += 8, len -= 8) {
+    memcpy(&w, p, 8);
+    h ^= rotl64(w * 0x87c37b91114253d5ULL, 31) * 0x4cf5ad432745937fULL;
+    h = rotl64(h, 27) * 5 + 0x52dce729;
+  }
+  for (w = 0; len > 0; len--)
+    w = (w << 8) | (unsigned char)p[len - 1];
+  h ^= rotl64(w * 0x87c37b91114253d5ULL, 31) * 0x4cf5ad432745937fULL;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/* 본문 하나가 메모리에서 차지하는 바이트 (본문 청크 + 기록 청크) */
+static size_t body_charge(int len)
+{
+  return slab_chunk_size(len) + slab_chunk_size(sizeof(dedup_body_t));
+}
+
+/*
+ * dedup_intern - slab에서 받은 본문 *data[0, len)을 풀에 넣고, 객체의 charge에 잡을
+ * 본문 바이트를 반환한다. 같은 본문이 이미 있으면 *data를 해제하고 그 본문으로 바꾼 뒤 0을
+ * 반환한다. 풀에 넣지 않은 본문(작거나 기록을 못 받음)이면 *body는 NULL이다.
+ * 아직 다른 스레드가 보지 않은 본문에만 호출한다.
+ */
+int dedup_intern(char **data, int len, dedup_body_t **body)
+{
+  uint64_t hash;
+  dedup_stripe_t *stripe;
+  dedup_body_t **bucket, *b;
+
+  *body = NULL;
+  if (len < DEDUP_MIN_BODY)
+    return slab_chunk_size(len);
+  Pthread_once(&dedup_once, dedup_init);
+  hash = body_hash(*data, len);
+  stripe = &stripes[hash >> (64 - DEDUP_STRIPE_BITS)];
+  bucket = &stripe->buckets[hash & (DEDUP_BUCKETS - 1)];
+
+  pthread_mutex_lock(&stripe->lock);
+  for (b = *bucket; b; b = b->next) {
+    if (b->hash == hash && b->len == len && !memcmp(b->data, *data, len)) {
+      b->refs++;
+      stripe->refs++;
+      stripe->saved_bytes += len;
+      stripe->hits++;
+      pthread_mutex_unlock(&stripe->lock);
+      slab_free(*data, len);
+      *data = b->data;
+      *body = b;
+      return 0;
+    }
+  }
+  if (!(b = slab_alloc(sizeof(dedup_body_t)))) {
+    pthread_mutex_unlock(&stripe->lock);
+    return slab_chunk_size(len);
+  }
+  b->hash = hash;
+  b->data = *data;
+  b->len = len;
+  b->refs = 1;
+  b->orphan = 0;
+  b->next = *bucket;
+  *bucket = b;
+  stripe->bodies++;
+  stripe->refs++;
+  pthread_mutex_unlock(&stripe->lock);
+  *body = b;
+  return body_charge(len);
+}
+
+/*
+ * dedup_put - 객체가 본문 참조를 돌려준다. 마지막 참조면 본문을 해제하고, owner(본문을
+ * charge에 잡은 객체)인데 다른 참조가 남아 있으면 본문을 orphan으로 돌린다.
+ */
+void dedup_put(dedup_body_t *body, int owner)
+{
+  dedup_stripe_t *stripe = &stripes[body->hash >> (64 - DEDUP_STRIPE_BITS)];
+  dedup_body_t **pp;
+
+  pthread_mutex_lock(&stripe->lock);
+  stripe->refs--;
+  if (--body->refs) {
+    stripe->saved_bytes -= body->len;
+    if (owner) {
+      __atomic_store_n(&body->orphan, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&orphan_bytes, body_charge(body->len), __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    return;
+  }
+  for (pp = &stripe->buckets[body->hash & (DEDUP_BUCKETS - 1)]; *pp != body; pp = &(*pp)->next)
+    ;
+  *pp = body->next;
+  stripe->bodies--;
+  if (body->orphan)
+    __atomic_sub_fetch(&orphan_bytes, body_charge(body->len), __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&stripe->lock);
+
+  slab_free(body->data, body->len);
+  slab_free(body, sizeof(dedup_body_t));
+}
+
+/*
+ * dedup_adopt - 본문이 orphan이면 호출한 객체가 새 주인이 되고, 그 객체의 charge에 더할
+ * 바이트를 반환한다. 아니면 0
+ */
+int dedup_adopt(dedup_body_t *body)
+{
+  dedup_stripe_t *stripe = &stripes[body->hash >> (64 - DEDUP_STRIPE_BITS)];
+  int adopted = 0;
+
+  if (!__atomic_load_n(&body->orphan, __ATOMIC_RELAXED)) // 보통은 락 없이 여기서 끝난다
+    return 0;
+  pthread_mutex_lock(&stripe->lock);
+  if (body->orphan) {
+    body->orphan = 0;
+    adopted = body_charge(body->len);
+    __atomic_sub_fetch(&orphan_bytes, adopted, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&stripe->lock);
+  return adopted;
+}
+
+/* dedup_orphan_bytes - 어느 객체의 charge에도 잡히지 않은 공유 본문 바이트 */
+size_t dedup_orphan_bytes(void)
+{
+  return __atomic_load_n(&orphan_bytes, __ATOMIC_RELAXED);
+}
+
+int dedup_stats(char *buf, int size)
+{
+  size_t bodies = 0, refs = 0, saved = 0;
+  unsigned long hits = 0;
+  int i, len;
+
+  Pthread_once(&dedup_once, dedup_init);
+  for (i = 0; i < DEDUP_STRIPES; i++) {
+    pthread_mutex_lock(&stripes[i].lock);
+    bodies += stripes[i].bodies;
+    refs += stripes[i].refs;
+    saved += stripes[i].saved_bytes;
+    hits += stripes[i].hits;
+    pthread_mutex_unlock(&stripes[i].lock);
+  }
+  len = snprintf(buf, size,
+                 "dedup_bodies %zu\n"
+                 "dedup_refs %zu\n"
+                 "dedup_ratio %.2f\n"
+                 "dedup_saved_bytes %zu\n"
+                 "dedup_orphan_bytes %zu\n"
+                 "dedup_hits %lu\n",
+                 bodies, refs, bodies ? (double)refs / bodies : 1.0, saved, dedup_orphan_bytes(),
+                 hits);
+  return len < size ? len : size;
+}
@@ -0,0 +1,34 @@
+/*
+ * dedup.h - 캐시 키가 달라도 내용이 같은 본문을 한 벌만 두는 내용 주소 본문 풀
+ *
+ * 버전이 붙은 정적 파일 경로나 미러 호스트처럼 같은 본문이 여러 URL로 오는 경우,
+ * write_cache가 본문의 64비트 해시로 풀을 찾아 이미 있는 같은 본문이 있으면 새 본문을
+ * 버리고 그 본문을 참조 수를 늘려 함께 쓴다. 해시가 같으면 길이와 내용을 모두 비교하므로
+ * 충돌이 나도 다른 본문을 섞어 쓰지 않는다.
+ *
+ * 본문 값은 처음 넣은 객체(주인)의 charge에 잡힌다. 주인이 먼저 해제되고 다른 객체가
+ * 남아 있으면 그 본문은 어느 샤드에도 잡히지 않은 바이트(orphan)가 되며, 캐시는 이를
+ * 샤드마다 나눠 사용량에 더해서 예산을 넘지 않게 한다. orphan 본문은 그 본문을 가리키는
+ * 객체가 다음에 적중할 때 그 객체가 넘겨받는다 (dedup_adopt).
+ */
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include <stdint.h>
+#include "csapp.h"
+
+#define DEDUP_MIN_BODY 1024 // 이보다 작은 본문은 기록 비용이 더 커서 풀에 넣지 않는다
+#define DEDUP_STRIPE_BITS 3
+#define DEDUP_STRIPES (1 << DEDUP_STRIPE_BITS) // 락 수
+#define DEDUP_BUCKETS 128   // 락마다 해시 버킷 수 (2의 거듭제곱)
+#define DEDUP_INDEX_SIZE (DEDUP_STRIPES * DEDUP_BUCKETS * sizeof(void *))
+
+typedef struct dedup_body_t dedup_body_t;
+
+int dedup_intern(char **data, int len, dedup_body_t **body);
+void dedup_put(dedup_body_t *body, int owner);
+int dedup_adopt(dedup_body_t *body);
+size_t dedup_orphan_bytes(void);
+int dedup_stats(char *buf, int size);
+
+#endif /* __DEDUP_H__ */
@@ -0,0 +1,527 @@
+/*
+ * disk.c - 로그 구조 세그먼트 파일 + 메모리 인덱스로 된 디스크 2차 캐시
+ *
+ * 레코드 형식: disk_rec_t 헤더, 키, Content-type, 본문 (패딩 없음)
+ */
+#include "disk.h"
+#include <sys/uio.h>
+
+#define DISK_MAGIC 0x4b534944 // "DISK"
+
+enum { JOB_DEMOTE, JOB_PROMOTE };
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t body_len;
+  uint16_t key_len;
+  uint16_t type_len;
+  uint32_t pad;
+  uint64_t hash;
+} disk_rec_t;
+
+typedef struct segment_t
+{
+  int id;
+  int fd;
+  off_t size;   // 다음 레코드를 쓸 위치 (예약 기준)
+  int refcnt;   // 진행 중인 쓰기, 전송, 승격 읽기 수
+  int dead;     // 목록에서 빠짐. refcnt가 0이 되면 닫는다
+  struct disk_entry_t *entries; // 이 세그먼트를 가리키는 인덱스 항목 (snext/sprev)
+  struct segment_t *next;
+} segment_t;
+
+typedef struct disk_entry_t
+{
+  uint64_t hash;
+  segment_t *seg;
+  off_t offset; // 본문 시작 위치
+  int length;
+  int hits;
+  int promoting;
+  uint64_t cached_at; // 메모리 캐시에 처음 들어간 시각 (밴 검사용)
+  unsigned short key_len;
+  unsigned char type_len;
+  struct disk_entry_t *hnext;
+  struct disk_entry_t *snext, *sprev; // 같은 세그먼트의 항목
+  char key[]; // key '\0' content_type '\0'
+} disk_entry_t;
+
+typedef struct disk_job_t
+{
+  int type;
+  web_object_t *web_object; // JOB_DEMOTE
+  segment_t *seg;           // JOB_PROMOTE
+  off_t offset;
+  int length;
+  uint64_t cached_at;
+  char content_type[256];
+  cache_key_t key;
+  struct disk_job_t *next;
+} disk_job_t;
+
+static int enabled = 0;
+static char disk_dir[MAXLINE - 32]; // 세그먼트 파일 이름("/seg.NNNNNN")이 붙어도 MAXLINE 안에 든다
+static size_t disk_max_bytes;
+
+static pthread_mutex_t disk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static disk_entry_t *buckets[DISK_BUCKETS];
+// 버킷마다 마지막 무효화 기준 시각. 이보다 먼저 캐싱된 객체는 강등 대기 중이었어도 쓰지 않는다
+static uint64_t invalidated_before[DISK_BUCKETS];
+static segment_t *oldest, *active; // 세그먼트 목록 (오래된 것 -> 새 것)
+static int next_segment_id, nsegments;
+static disk_job_t *job_head, *job_tail;
+static int njobs;
+
+/* 통계 (disk_lock 아래에서 갱신) */
+static size_t entries, live_bytes, index_bytes, pending_bytes;
+static unsigned long hits, misses, demotions, promotions, dropped, stale, io_errors, segments_dropped;
+
+static void *io_thread(void *vargp);
+
+static void segment_path(char *buf, int id)
+{
+  snprintf(buf, MAXLINE, "%s/seg.%06d", disk_dir, id);
+}
+
+static void segment_put(segment_t *seg)
+{
+  if (--seg->refcnt == 0 && seg->dead) {
+    close(seg->fd);
+    free(seg);
+  }
+}
+
+static void remove_entry(disk_entry_t **pp)
+{
+  disk_entry_t *entry = *pp;
+
+  *pp = entry->hnext;
+  if (entry->sprev)
+    entry->sprev->snext = entry->snext;
+  else
+    entry->seg->entries = entry->snext;
+  if (entry->snext)
+    entry->snext->sprev = entry->sprev;
+  entries--;
+  live_bytes -= entry->length;
+  index_bytes -= sizeof(disk_entry_t) + entry->key_len + entry->type_len + 2;
+  free(entry);
+}
+
+/*
+ * 가장 오래된 세그먼트와 그 안의 인덱스 항목을 모두 지운다. 세그먼트의 항목 목록만 따라가므로
+ * 인덱스 전체를 훑지 않는다. disk_lock 아래에서 호출
+ */
+static void drop_oldest_segment(void)
+{
+  segment_t *seg = oldest;
+  char path[MAXLINE];
+
+  oldest = seg->next;
+  nsegments--;
+  segments_dropped++;
+  while (seg->entries) {
+    disk_entry_t **pp = &buckets[seg->entries->hash & (DISK_BUCKETS - 1)];
+    while (*pp != seg->entries)
+      pp = &(*pp)->hnext;
+    remove_entry(pp);
+  }
+
+  // 전송 중인 스레드는 열린 fd로 계속 읽을 수 있으므로 파일은 바로 지운다
+  segment_path(path, seg->id);
+  unlink(path);
+  seg->dead = 1;
+  seg->refcnt++;
+  segment_put(seg);
+}
+
+/* 새 세그먼트를 열어 active로 만들고, 전체 크기 한도를 넘으면 오래된 것부터 지운다 */
+static int new_segment(void)
+{
+  char path[MAXLINE];
+  segment_t *seg;
+  int fd;
+
+  segment_path(path, next_segment_id);
+  if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+    fprintf(stderr, "disk cache: cannot create %s: %s\n", path, strerror(errno));
+    io_errors++;
+    return -1;
+  }
+  if (!(seg = calloc(1, sizeof(segment_t)))) {
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+  seg->id = next_segment_id++;
+  seg->fd = fd;
+  if (active)
+    active->next = seg;
+  else
+    oldest = seg;
+  active = seg;
+  nsegments++;
+
+  while ((size_t)nsegments * DISK_SEGMENT_SIZE > disk_max_bytes && oldest != active)
+    drop_oldest_segment();
+  return 0;
+}
+
+/*
+ * disk_init - dir 아래 DISK_SUBDIR에 세그먼트 파일을 만들고 I/O 스레드를 띄운다.
+ * 인덱스는 메모리에만 있으므로 이전 실행의 세그먼트 파일은 지운다. dir은 다른 것과 함께
+ * 쓰는 디렉터리일 수 있으므로 지우는 것은 DISK_SUBDIR 안의 seg.* 파일뿐이다.
+ */
+int disk_init(char *dir, size_t max_bytes)
+{
+  DIR *dp;
+  struct dirent *de;
+  pthread_t tid;
+  int i;
+
+  if (strlen(dir) + strlen("/" DISK_SUBDIR) >= sizeof(disk_dir)) {
+    fprintf(stderr, "disk cache: directory name too long: %s\n", dir);
+    return -1;
+  }
+  snprintf(disk_dir, sizeof(disk_dir), "%s/" DISK_SUBDIR, dir);
+  disk_max_bytes = max_bytes < DISK_SEGMENT_SIZE ? DISK_SEGMENT_SIZE : max_bytes;
+
+  if ((mkdir(dir, 0700) < 0 && errno != EEXIST) || (mkdir(disk_dir, 0700) < 0 && errno != EEXIST)) {
+    fprintf(stderr, "disk cache: cannot create %s: %s\n", disk_dir, strerror(errno));
+    return -1;
+  }
+  if ((dp = opendir(disk_dir))) {
+    while ((de = readdir(dp))) {
+      if (!strncmp(de->d_name, "seg.", 4)) {
+        char path[sizeof(disk_dir) + sizeof(de->d_name) + 1];
+        snprintf(path, sizeof(path), "%s/%s", disk_dir, de->d_name);
+        unlink(path);
+      }
+    }
+    closedir(dp);
+  }
+
+  if (new_segment() < 0)
+    return -1;
+  for (i = 0; i < DISK_IO_THREADS; i++)
+    Pthread_create(&tid, NULL, io_thread, NULL);
+  enabled = 1;
+  return 0;
+}
+
+static int push_job(disk_job_t *job)
+{
+  if (njobs >= DISK_QUEUE_MAX)
+    return -1;
+  job->next = NULL;
+  if (job_tail)
+    job_tail->next = job;
+  else
+    job_head = job;
+  job_tail = job;
+  njobs++;
+  pthread_cond_signal(&job_cond);
+  return 0;
+}
+
+/*
+ * disk_demote - 메모리 캐시에서 LRU로 밀려난 객체를 디스크 쓰기 큐에 넣는다.
+ * 객체의 소유권을 넘겨받으며, 디스크 캐시가 꺼져 있거나 큐가 차 있으면 바로 해제한다.
+ */
+void disk_demote(web_object_t *web_object)
+{
+  disk_job_t *job;
+
+  if (!enabled || !(job = malloc(sizeof(disk_job_t)))) {
+    free_web_object(web_object);
+    return;
+  }
+  job->type = JOB_DEMOTE;
+  job->web_object = web_object;
+
+  pthread_mutex_lock(&disk_lock);
+  if (push_job(job) < 0) {
+    dropped++;
+    pthread_mutex_unlock(&disk_lock);
+    free(job);
+    free_web_object(web_object);
+    return;
+  }
+  pending_bytes += web_object->charge;
+  pthread_mutex_unlock(&disk_lock);
+}
+
+static disk_entry_t **find_entry(uint64_t hash, char *key, int key_len)
+{
+  disk_entry_t **pp = &buckets[hash & (DISK_BUCKETS - 1)];
+
+  for (; *pp; pp = &(*pp)->hnext)
+    if ((*pp)->hash == hash && (*pp)->key_len == key_len && !memcmp((*pp)->key, key, key_len))
+      return pp;
+  return NULL;
+}
+
+/* 강등을 기다리는 동안 같은 키가 퍼지되거나 새 객체로 바뀌었으면 1. disk_lock 아래에서 호출 */
+static int stale_object(web_object_t *web_object)
+{
+  if (web_object->cached_at >= invalidated_before[web_object->hash & (DISK_BUCKETS - 1)])
+    return 0;
+  stale++;
+  return 1;
+}
+
+/* 객체를 active 세그먼트 끝에 쓰고 인덱스에 넣는다. I/O 스레드에서 호출 */
+static void append_object(web_object_t *web_object)
+{
+  disk_rec_t rec = {0};
+  struct iovec iov[4];
+  size_t rec_len = sizeof(rec) + web_object->key_len + web_object->type_len + web_object->content_length;
+  segment_t *seg;
+  off_t offset;
+  disk_entry_t *entry, **pp;
+
+  rec.magic = DISK_MAGIC;
+  rec.body_len = web_object->content_length;
+  rec.key_len = web_object->key_len;
+  rec.type_len = web_object->type_len;
+  rec.hash = web_object->hash;
+
+  // 쓸 자리만 락 안에서 예약하고 실제 쓰기는 락 밖에서
+  pthread_mutex_lock(&disk_lock);
+  if (stale_object(web_object) ||
+      (active->size + rec_len > DISK_SEGMENT_SIZE && new_segment() < 0)) {
+    pthread_mutex_unlock(&disk_lock);
+    return;
+  }
+  seg = active;
+  offset = seg->size;
+  seg->size += rec_len;
+  seg->refcnt++;
+  pthread_mutex_unlock(&disk_lock);
+
+  iov[0].iov_base = &rec;
+  iov[0].iov_len = sizeof(rec);
+  iov[1].iov_base = web_object->key;
+  iov[1].iov_len = web_object->key_len;
+  iov[2].iov_base = OBJECT_TYPE(web_object);
+  iov[2].iov_len = web_object->type_len;
+  iov[3].iov_base = web_object->response_ptr;
+  iov[3].iov_len = web_object->content_length;
+
+  if (pwritev(seg->fd, iov, 4, offset) != (ssize_t)rec_len) {
+    pthread_mutex_lock(&disk_lock);
+    io_errors++;
+    segment_put(seg);
+    pthread_mutex_unlock(&disk_lock);
+    return;
+  }
+
+  if (!(entry = malloc(sizeof(disk_entry_t) + web_object->key_len + web_object->type_len + 2))) {
+    pthread_mutex_lock(&disk_lock);
+    segment_put(seg);
+    pthread_mutex_unlock(&disk_lock);
+    return;
+  }
+  entry->hash = web_object->hash;
+  entry->seg = seg;
+  entry->offset = offset + rec_len - web_object->content_length;
+  entry->length = web_object->content_length;
+  entry->hits = 0;
+  entry->promoting = 0;
+  entry->cached_at = web_object->cached_at;
+  entry->key_len = web_object->key_len;
+  entry->type_len = web_object->type_len;
+  memcpy(entry->key, web_object->key, web_object->key_len + web_object->type_len + 2);
+
+  pthread_mutex_lock(&disk_lock);
+  if (seg->dead || stale_object(web_object)) { // 쓰는 사이에 세그먼트가 지워졌거나 키가 무효화됨
+    free(entry);
+  } else {
+    if ((pp = find_entry(entry->hash, entry->key, entry->key_len)))
+      remove_entry(pp);
+    pp = &buckets[entry->hash & (DISK_BUCKETS - 1)];
+    entry->hnext = *pp;
+    *pp = entry;
+    entry->sprev = NULL;
+    if ((entry->snext = seg->entries))
+      seg->entries->sprev = entry;
+    seg->entries = entry;
+    entries++;
+    live_bytes += entry->length;
+    index_bytes += sizeof(disk_entry_t) + entry->key_len + entry->type_len + 2;
+    demotions++;
+  }
+  segment_put(seg);
+  pthread_mutex_unlock(&disk_lock);
+}
+
+/* 디스크의 본문을 읽어 메모리 캐시에 다시 넣는다. I/O 스레드에서 호출 */
+static void promote_object(disk_job_t *job)
+{
+  web_object_t *web_object = alloc_web_object(&job->key, job->content_type, job->length);
+
+  if (web_object) {
+    web_object->cached_at = job->cached_at; // 디스크에 있던 동안 발행된 밴도 계속 적용되도록
+    if (pread(job->seg->fd, web_object->response_ptr, job->length, job->offset) == job->length) {
+      // 디스크 인덱스 항목은 write_cache가 지운다. 입장 필터가 거절하면 디스크에 남는다
+      if (write_cache(web_object)) {
+        pthread_mutex_lock(&disk_lock);
+        promotions++;
+        pthread_mutex_unlock(&disk_lock);
+      }
+    } else {
+      free_web_object(web_object);
+      pthread_mutex_lock(&disk_lock);
+      io_errors++;
+      pthread_mutex_unlock(&disk_lock);
+    }
+  }
+
+  pthread_mutex_lock(&disk_lock);
+  disk_entry_t **pp = find_entry(job->key.hash, job->key.str, job->key.len);
+  if (pp)
+    (*pp)->promoting = 0;
+  segment_put(job->seg);
+  pthread_mutex_unlock(&disk_lock);
+}
+
+static void *io_thread(void *vargp)
+{
+  Pthread_detach(pthread_self());
+
+  while (1) {
+    disk_job_t *job;
+
+    pthread_mutex_lock(&disk_lock);
+    while (!job_head)
+      pthread_cond_wait(&job_cond, &disk_lock);
+    job = job_head;
+    if (!(job_head = job->next))
+      job_tail = NULL;
+    njobs--;
+    if (job->type == JOB_DEMOTE)
+      pending_bytes -= job->web_object->charge;
+    pthread_mutex_unlock(&disk_lock);
+
+    if (job->type == JOB_DEMOTE) {
+      append_object(job->web_object);
+      free_web_object(job->web_object);
+    } else
+      promote_object(job);
+    free(job);
+  }
+  return NULL;
+}
+
+/*
+ * disk_find - 디스크 인덱스에서 키를 찾아 hit를 채우고 1을 반환, 없으면 0.
+ * 세그먼트를 붙잡아 두므로 전송이 끝나면 disk_release를 불러야 한다.
+ * 자주 적중하는 객체는 I/O 스레드에 메모리 승격을 맡긴다.
+ */
+int disk_find(cache_key_t *key, disk_hit_t *hit)
+{
+  disk_entry_t **pp, *entry;
+  disk_job_t *job;
+
+  if (!enabled)
+    return 0;
+
+  pthread_mutex_lock(&disk_lock);
+  if (!(pp = find_entry(key->hash, key->str, key->len))) {
+    misses++;
+    pthread_mutex_unlock(&disk_lock);
+    return 0;
+  }
+  entry = *pp;
+  if (ban_check(entry->key, entry->key_len, entry->cached_at, NULL, 0)) {
+    if (!entry->promoting) // 승격 중이면 promote_object가 항목을 다시 찾으므로 남겨 둔다
+      remove_entry(pp);
+    misses++;
+    pthread_mutex_unlock(&disk_lock);
+    return 0;
+  }
+  hits++;
+  hit->fd = entry->seg->fd;
+  hit->offset = entry->offset;
+  hit->length = entry->length;
+  memcpy(hit->content_type, entry->key + entry->key_len + 1, entry->type_len + 1);
+  hit->segment = entry->seg;
+  entry->seg->refcnt++;
+
+  if (++entry->hits >= DISK_PROMOTE_HITS && !entry->promoting &&
+      (job = malloc(sizeof(disk_job_t)))) {
+    job->type = JOB_PROMOTE;
+    job->seg = entry->seg;
+    job->offset = entry->offset;
+    job->length = entry->length;
+    job->cached_at = entry->cached_at;
+    memcpy(job->content_type, hit->content_type, entry->type_len + 1);
+    job->key = *key;
+    if (push_job(job) == 0) {
+      entry->promoting = 1;
+      entry->seg->refcnt++;
+    } else
+      free(job);
+  }
+  pthread_mutex_unlock(&disk_lock);
+  return 1;
+}
+
+void disk_release(disk_hit_t *hit)
+{
+  pthread_mutex_lock(&disk_lock);
+  segment_put(hit->segment);
+  pthread_mutex_unlock(&disk_lock);
+}
+
+/*
+ * disk_invalidate - 메모리 캐시에 새로 들어왔거나 퍼지된 키의 디스크 사본을 인덱스에서 빼고,
+ * before보다 먼저 캐싱되어 아직 강등을 기다리는 사본도 나중에 쓰지 않게 한다. 있었으면 1
+ */
+int disk_invalidate(uint64_t hash, char *key, int key_len, uint64_t before)
+{
+  disk_entry_t **pp;
+  uint64_t *mark = &invalidated_before[hash & (DISK_BUCKETS - 1)];
+
+  if (!enabled)
+    return 0;
+  pthread_mutex_lock(&disk_lock);
+  if (before > *mark)
+    *mark = before;
+  if ((pp = find_entry(hash, key, key_len)))
+    remove_entry(pp);
+  pthread_mutex_unlock(&disk_lock);
+  return pp != NULL;
+}
+
+int disk_stats(char *buf, int size)
+{
+  int len;
+
+  if (!enabled)
+    return 0;
+  pthread_mutex_lock(&disk_lock);
+  len = snprintf(buf, size,
+                 "disk_segments %d\n"
+                 "disk_bytes %zu\n"
+                 "disk_budget_bytes %zu\n"
+                 "disk_objects %zu\n"
+                 "disk_live_bytes %zu\n"
+                 "disk_index_bytes %zu\n"
+                 "disk_hits %lu\n"
+                 "disk_misses %lu\n"
+                 "disk_demotions %lu\n"
+                 "disk_promotions %lu\n"
+                 "disk_demote_pending_bytes %zu\n"
+                 "disk_dropped %lu\n"
+                 "disk_stale_demotes %lu\n"
+                 "disk_segments_dropped %lu\n"
+                 "disk_io_errors %lu\n",
+                 nsegments, (size_t)(nsegments - 1) * DISK_SEGMENT_SIZE + active->size,
+                 disk_max_bytes, entries, live_bytes, index_bytes, hits, misses, demotions,
+                 promotions, pending_bytes, dropped, stale, segments_dropped, io_errors);
+  pthread_mutex_unlock(&disk_lock);
+  return len < size ? len : size;
+}
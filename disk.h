@@ -0,0 +1,37 @@
+/*
+ * disk.h - 메모리 캐시에서 밀려난 객체를 담는 디스크(SSD) 2차 캐시
+ *
+ * 큰 세그먼트 파일에 레코드를 append만 하는 로그 구조 저장소이고, 인덱스는 메모리에 둔다.
+ * 전체 크기가 한도를 넘으면 가장 오래된 세그먼트를 통째로 지운다.
+ * 디스크 쓰기(강등)와 승격을 위한 읽기는 I/O 스레드 풀이 처리하고,
+ * 디스크 적중은 세그먼트 파일에서 sendfile로 바로 클라이언트에 보낸다.
+ */
+#ifndef __DISK_H__
+#define __DISK_H__
+
+#include "cache.h"
+
+#define DISK_SUBDIR "proxy-disk"      // -d 디렉터리 아래에 만들어 이 프록시만 쓰는 디렉터리
+#define DISK_SEGMENT_SIZE (64 << 20) // 세그먼트 파일 하나의 크기
+#define DISK_BUCKETS 65536           // 인덱스 해시 버킷 수 (2의 거듭제곱)
+#define DISK_IO_THREADS 2
+#define DISK_QUEUE_MAX 256           // I/O 큐 길이, 넘치면 강등/승격을 건너뛴다
+#define DISK_PROMOTE_HITS 2          // 이만큼 디스크에서 적중하면 메모리로 승격
+
+typedef struct
+{
+  int fd;           // 세그먼트 파일
+  off_t offset;     // 본문 시작 위치
+  int length;
+  char content_type[256];
+  void *segment;    // disk_release 전까지 세그먼트를 붙잡아 둔다
+} disk_hit_t;
+
+int disk_init(char *dir, size_t max_bytes);
+void disk_demote(web_object_t *web_object);
+int disk_find(cache_key_t *key, disk_hit_t *hit);
+void disk_release(disk_hit_t *hit);
+int disk_invalidate(uint64_t hash, char *key, int key_len, uint64_t before);
+int disk_stats(char *buf, int size);
+
+#endif /* __DISK_H__ */
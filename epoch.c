@@ -0,0 +1,95 @@
+/*
+ * epoch.c - 에포크 기반 회수
+ *
+ * 슬롯은 스레드마다 처음 읽을 때 하나 차지하고 스레드가 끝나면 돌려준다. 연결마다 스레드를
+ * 만들므로 슬롯을 차지하는 비용(CAS 한 번)은 연결당 한 번이고, 적중 경로에는 없다.
+ */
+#include "epoch.h"
+
+typedef struct
+{
+  uint64_t epoch; // 읽는 중이면 들어올 때의 에포크, 아니면 0
+  int used;       // 스레드가 차지한 슬롯
+} __attribute__((aligned(64))) epoch_slot_t;
+
+static epoch_slot_t slots[EPOCH_MAX_READERS];
+static uint64_t global_epoch = 1; // 0은 "읽는 중 아님"이므로 1부터
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slot_key;
+static __thread epoch_slot_t *my_slot;
+
+static void release_slot(void *vargp)
+{
+  epoch_slot_t *slot = vargp;
+
+  __atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&slot->used, 0, __ATOMIC_RELEASE);
+}
+
+static void epoch_init(void)
+{
+  pthread_key_create(&slot_key, release_slot);
+}
+
+/* 빈 슬롯을 하나 차지한다. 모두 차 있으면 NULL */
+static epoch_slot_t *claim_slot(void)
+{
+  int i, unused;
+
+  Pthread_once(&epoch_once, epoch_init);
+  for (i = 0; i < EPOCH_MAX_READERS; i++) {
+    unused = 0;
+    if (!__atomic_load_n(&slots[i].used, __ATOMIC_RELAXED) &&
+        __atomic_compare_exchange_n(&slots[i].used, &unused, 1, 0, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+      pthread_setspecific(slot_key, &slots[i]);
+      return &slots[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * epoch_enter - 읽기 구간에 들어간다. 슬롯이 없으면 0을 반환하고, 호출자는 락을 잡는
+ * 경로를 써야 한다. 구간 안에서는 블록될 수 있는 일을 오래 하지 않는다.
+ */
+int epoch_enter(void)
+{
+  if (!my_slot && !(my_slot = claim_slot()))
+    return 0;
+  __atomic_store_n(&my_slot->epoch, __atomic_load_n(&global_epoch, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+  // 슬롯에 적은 에포크가 인덱스를 읽기 전에 다른 코어에 보여야 한다 (store-load 순서)
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return 1;
+}
+
+void epoch_leave(void)
+{
+  __atomic_store_n(&my_slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+uint64_t epoch_current(void)
+{
+  return __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * epoch_try_advance - 읽는 중인 모든 스레드가 지금 에포크에 있으면 에포크를 하나 올리고
+ * 새 에포크를 반환, 아니면 0. 에포크 e - 1 이전에 보류한 객체는 e + 1이 된 뒤에 해제해도 된다.
+ * 쓰는 쪽끼리는 호출자가 직렬화한다.
+ */
+uint64_t epoch_try_advance(void)
+{
+  uint64_t e = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED), seen;
+  int i;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (i = 0; i < EPOCH_MAX_READERS; i++) {
+    seen = __atomic_load_n(&slots[i].epoch, __ATOMIC_ACQUIRE);
+    if (seen && seen != e)
+      return 0;
+  }
+  __atomic_store_n(&global_epoch, e + 1, __ATOMIC_SEQ_CST);
+  return e + 1;
+}
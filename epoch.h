@@ -0,0 +1,23 @@
+/*
+ * epoch.h - 캐시 인덱스를 락 없이 읽기 위한 에포크 기반 회수 (EBR)
+ *
+ * 읽는 스레드는 epoch_enter로 지금 에포크를 자기 슬롯에 적고, 인덱스를 따라가 본문을
+ * 읽은 뒤 epoch_leave로 슬롯을 비운다. 그 사이에는 원자적 read-modify-write가 없다.
+ * 쓰는 쪽은 객체를 인덱스에서 뗀 뒤 그 시점의 에포크와 함께 보류해 두고, 에포크가 두 번
+ * 넘어간 뒤(모든 읽는 스레드가 그 객체를 볼 수 있던 구간을 벗어난 뒤)에 해제한다.
+ * 에포크는 활동 중인 모든 슬롯이 지금 에포크에 있을 때만 하나 올라간다.
+ */
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <stdint.h>
+#include "csapp.h"
+
+#define EPOCH_MAX_READERS 256 // 동시에 읽을 수 있는 스레드 수. 넘으면 락 경로를 쓴다
+
+int epoch_enter(void);
+void epoch_leave(void);
+uint64_t epoch_current(void);
+uint64_t epoch_try_advance(void);
+
+#endif /* __EPOCH_H__ */
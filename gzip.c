@@ -0,0 +1,294 @@
+/*
+ * gzip.c - 백그라운드 압축기와 gzip 객체 전송
+ */
+#include <zlib.h>
+#include "gzip.h"
+#include "io.h"
+#include "bufpool.h"
+
+typedef struct gzip_job_t
+{
+  struct gzip_job_t *next;
+  uint64_t hash;
+  int len;
+  char key[]; // 정규화된 캐시 키
+} gzip_job_t;
+
+static pthread_mutex_t gzip_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gzip_cond = PTHREAD_COND_INITIALIZER;
+static gzip_job_t *job_head, *job_tail;
+static int njobs, started;
+
+static unsigned long queued, dropped, compressed, skipped, raced;
+static unsigned long long bytes_in, bytes_out;
+static unsigned long sent_encoded, sent_inflated;
+static unsigned long long egress_saved;
+
+/* 압축해서 이득이 있는 Content-type이면 1 */
+static int compressible(char *content_type)
+{
+  static const char *types[] = { "text/", "application/javascript", "application/x-javascript",
+                                 "application/json", "application/xml", "image/svg+xml", NULL };
+  int i;
+
+  for (i = 0; types[i]; i++)
+    if (!strncasecmp(content_type, types[i], strlen(types[i])))
+      return 1;
+  return 0;
+}
+
+/* gzip_wanted - 압축해 둘 객체이면 1 (압축하지 않은 200 텍스트 응답, GZIP_MIN_SIZE 이상) */
+int gzip_wanted(web_object_t *web_object)
+{
+  return web_object->status == 200 && web_object->encoding == OBJECT_IDENTITY &&
+         web_object->content_length >= GZIP_MIN_SIZE && compressible(OBJECT_TYPE(web_object));
+}
+
+/* gzip_vary - 이 Content-type의 캐시 응답에 붙일 Vary 헤더 (없으면 NULL) */
+char *gzip_vary(char *content_type)
+{
+  return content_type && compressible(content_type) ? GZIP_VARY_HDR : NULL;
+}
+
+/*
+ * gzip_accepted - Accept-Encoding 값이 gzip을 받으면 1. gzip(x-gzip)이 q=0이 아니게 있거나,
+ * 따로 적지 않았고 *가 q=0이 아니면 받는다.
+ */
+int gzip_accepted(char *accept_encoding)
+{
+  char *p = accept_encoding, *q;
+  int gzip = -1, star = -1, len, ok;
+
+  while (*p) {
+    p += strspn(p, ", \t\r\n");
+    len = strcspn(p, ",; \t\r\n");
+    ok = 1;
+    for (q = p + len; *q && *q != ','; q++)
+      if ((*q == 'q' || *q == 'Q') && q[1] == '=')
+        ok = strtod(q + 2, NULL) > 0;
+    if ((len == 4 && !strncasecmp(p, "gzip", 4)) || (len == 6 && !strncasecmp(p, "x-gzip", 6)))
+      gzip = ok;
+    else if (len == 1 && *p == '*')
+      star = ok;
+    p = q;
+  }
+  return gzip >= 0 ? gzip : star > 0;
+}
+
+/*
+ * gzip_offer - 방금 캐시에 넣은 키를 압축 큐에 넣는다. 압축기를 띄우지 않았거나 큐가 차
+ * 있으면 버린다 (그 객체는 압축하지 않은 채로 남는다).
+ */
+void gzip_offer(cache_key_t *key)
+{
+  gzip_job_t *job;
+
+  if (!started || !(job = malloc(sizeof(gzip_job_t) + key->len + 1)))
+    return;
+  job->next = NULL;
+  job->hash = key->hash;
+  job->len = key->len;
+  memcpy(job->key, key->str, key->len + 1);
+
+  pthread_mutex_lock(&gzip_lock);
+  if (njobs >= GZIP_QUEUE_MAX) {
+    dropped++;
+    pthread_mutex_unlock(&gzip_lock);
+    free(job);
+    return;
+  }
+  if (job_tail)
+    job_tail->next = job;
+  else
+    job_head = job;
+  job_tail = job;
+  njobs++;
+  queued++;
+  pthread_cond_signal(&gzip_cond);
+  pthread_mutex_unlock(&gzip_lock);
+}
+
+/* src[0, len)를 gzip 형식으로 압축해 out에 쓰고 길이를 반환. 실패하거나 out_size를 넘으면 -1 */
+static int deflate_gzip(char *src, int len, char *out, int out_size)
+{
+  z_stream zs;
+  int n;
+
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+  zs.next_in = (Bytef *)src;
+  zs.avail_in = len;
+  zs.next_out = (Bytef *)out;
+  zs.avail_out = out_size;
+  n = deflate(&zs, Z_FINISH) == Z_STREAM_END ? (int)zs.total_out : -1;
+  deflateEnd(&zs);
+  return n;
+}
+
+/* 키의 현재 객체를 압축해 gzip 객체로 바꿔 넣는다 */
+static void compress_object(cache_key_t *key, char *out, int out_size)
+{
+  web_object_t *web_object, *encoded;
+  int n;
+
+  if (!(web_object = cache_peek(key)))
+    return; // 그 사이 제거되거나 입장 필터가 거절했다
+  if (!gzip_wanted(web_object)) {
+    release_cache(web_object);
+    return;
+  }
+
+  n = deflate_gzip(web_object->response_ptr, web_object->content_length, out, out_size);
+  if (n < 0 || (long)n * 100 > (long)web_object->content_length * GZIP_MAX_RATIO) {
+    pthread_mutex_lock(&gzip_lock);
+    skipped++;
+    pthread_mutex_unlock(&gzip_lock);
+    release_cache(web_object);
+    return;
+  }
+
+  encoded = alloc_tagged_object(key, OBJECT_TYPE(web_object), n, OBJECT_TAGS(web_object),
+                                web_object->ntags);
+  if (encoded) {
+    memcpy(encoded->response_ptr, out, n);
+    encoded->encoding = OBJECT_GZIP;
+    encoded->vary = web_object->vary;
+    encoded->identity_length = web_object->content_length;
+    encoded->expires = web_object->expires;
+    encoded->cached_at = web_object->cached_at; // 같은 응답이므로 밴 판정도 원래 시각 기준
+  }
+
+  pthread_mutex_lock(&gzip_lock);
+  if (!encoded || !cache_replace(web_object, encoded)) {
+    raced++; // 그 사이 새 응답으로 바뀌었거나 빠졌다
+  } else {
+    compressed++;
+    bytes_in += web_object->content_length;
+    bytes_out += n;
+  }
+  pthread_mutex_unlock(&gzip_lock);
+  release_cache(web_object);
+}
+
+static void *gzip_thread(void *vargp)
+{
+  int out_size = compressBound(MAX_OBJECT_SIZE) + 32; // gzip 헤더와 트레일러
+  char *out = Malloc(out_size);
+  cache_key_t key;
+  gzip_job_t *job;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    pthread_mutex_lock(&gzip_lock);
+    while (!job_head)
+      pthread_cond_wait(&gzip_cond, &gzip_lock);
+    job = job_head;
+    if (!(job_head = job->next))
+      job_tail = NULL;
+    njobs--;
+    pthread_mutex_unlock(&gzip_lock);
+
+    memcpy(key.str, job->key, job->len + 1);
+    key.len = job->len;
+    key.hash = job->hash;
+    free(job);
+    compress_object(&key, out, out_size);
+  }
+  return NULL;
+}
+
+/* gzip_start - 압축 스레드를 띄운다. 부르지 않으면 모든 객체를 압축하지 않은 채로 둔다 */
+void gzip_start(void)
+{
+  pthread_t tid;
+
+  started = 1;
+  Pthread_create(&tid, NULL, gzip_thread, NULL);
+}
+
+/*
+ * gzip_send - gzip 본문 src[0, len)의 압축을 조금씩 풀면서 fd로 보낸다. 본문이 깨졌으면 -1.
+ * 출력 버퍼는 연결 스레드 스택 대신 bufpool에서 빌린다.
+ */
+int gzip_send(int fd, char *src, int len)
+{
+  growbuf_t out = { NULL, 0 };
+  z_stream zs;
+  int ret;
+
+  memset(&zs, 0, sizeof(zs));
+  if (growbuf_reserve(&out, BUFPOOL_LARGE) < 0)
+    return -1;
+  if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+    growbuf_free(&out);
+    return -1;
+  }
+  zs.next_in = (Bytef *)src;
+  zs.avail_in = len;
+  do {
+    zs.next_out = (Bytef *)out.ptr;
+    zs.avail_out = out.size;
+    ret = inflate(&zs, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END)
+      break;
+    if (io_writen(fd, out.ptr, out.size - zs.avail_out) < 0)
+      break; // 클라이언트가 끊었다
+  } while (ret != Z_STREAM_END);
+  inflateEnd(&zs);
+  growbuf_free(&out);
+  __sync_fetch_and_add(&sent_inflated, 1);
+  return ret == Z_STREAM_END ? 0 : -1;
+}
+
+/* gzip_inflate - gzip 본문의 압축을 풀어 out에 정확히 out_len 바이트를 쓴다. 실패하면 -1 */
+int gzip_inflate(char *src, int len, char *out, int out_len)
+{
+  z_stream zs;
+  int ret;
+
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    return -1;
+  zs.next_in = (Bytef *)src;
+  zs.avail_in = len;
+  zs.next_out = (Bytef *)out;
+  zs.avail_out = out_len;
+  ret = inflate(&zs, Z_FINISH);
+  inflateEnd(&zs);
+  if (ret != Z_STREAM_END || zs.total_out != (uLong)out_len)
+    return -1;
+  __sync_fetch_and_add(&sent_inflated, 1);
+  return 0;
+}
+
+/* gzip_count_sent - gzip 객체를 압축된 그대로 보냈다 */
+void gzip_count_sent(web_object_t *web_object)
+{
+  __sync_fetch_and_add(&sent_encoded, 1);
+  __sync_fetch_and_add(&egress_saved, web_object->identity_length - web_object->content_length);
+}
+
+int gzip_stats(char *buf, int size)
+{
+  int len;
+
+  pthread_mutex_lock(&gzip_lock);
+  len = snprintf(buf, size,
+                 "gzip_queued %lu\n"
+                 "gzip_queue_dropped %lu\n"
+                 "gzip_compressed %lu\n"
+                 "gzip_skipped %lu\n"
+                 "gzip_raced %lu\n"
+                 "gzip_bytes_in %llu\n"
+                 "gzip_bytes_out %llu\n"
+                 "gzip_sent_encoded %lu\n"
+                 "gzip_sent_inflated %lu\n"
+                 "gzip_egress_saved_bytes %llu\n",
+                 queued, dropped, compressed, skipped, raced, bytes_in, bytes_out,
+                 __atomic_load_n(&sent_encoded, __ATOMIC_RELAXED),
+                 __atomic_load_n(&sent_inflated, __ATOMIC_RELAXED),
+                 __atomic_load_n(&egress_saved, __ATOMIC_RELAXED));
+  pthread_mutex_unlock(&gzip_lock);
+  return len < size ? len : size;
+}
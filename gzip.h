@@ -0,0 +1,33 @@
+/*
+ * gzip.h - 텍스트 객체를 gzip으로 저장하는 백그라운드 압축기
+ *
+ * 원 서버에는 Accept-Encoding을 빼고 요청하므로 캐시에는 항상 압축하지 않은 본문이 들어온다.
+ * 텍스트 객체(text/…, JavaScript, JSON, XML, SVG)는 캐시에 넣은 뒤 키만 큐에 넣고, 압축
+ * 스레드가 한 번 압축해서 같은 키의 gzip 객체로 바꿔 넣는다 (cache_replace). 요청 스레드는
+ * 압축을 기다리지 않는다.
+ *
+ * Accept-Encoding에 gzip이 있는 클라이언트에는 압축된 바이트를 그대로 보내고, 아닌 클라이언트와
+ * Range 요청에는 압축을 풀어서 보낸다. 어느 쪽이든 Vary: Accept-Encoding을 붙인다.
+ */
+#ifndef __GZIP_H__
+#define __GZIP_H__
+
+#include "cache.h"
+
+#define GZIP_MIN_SIZE 256   // 이보다 작은 본문은 압축하지 않는다
+#define GZIP_MAX_RATIO 90   // 압축 결과가 원본의 이 % 이하일 때만 바꿔 넣는다
+#define GZIP_QUEUE_MAX 1024 // 대기 중인 압축 작업 수. 넘치면 버린다
+#define GZIP_LEVEL 6
+#define GZIP_VARY_HDR "Vary: Accept-Encoding\r\n"
+
+void gzip_start(void);
+int gzip_wanted(web_object_t *web_object);
+char *gzip_vary(char *content_type);
+int gzip_accepted(char *accept_encoding);
+void gzip_offer(cache_key_t *key);
+int gzip_send(int fd, char *src, int len);
+int gzip_inflate(char *src, int len, char *out, int out_len);
+void gzip_count_sent(web_object_t *web_object);
+int gzip_stats(char *buf, int size);
+
+#endif /* __GZIP_H__ */
@@ -0,0 +1,202 @@
+/*
+ * io.c - 오류를 돌려주는 rio 읽기/쓰기
+ */
+#include <poll.h>
+#include "io.h"
+
+static unsigned long read_errors, write_errors, eagain_waits, timeouts;
+
+/* io_init - 끊긴 소켓에 쓰다가 SIGPIPE로 프로세스가 끝나지 않게 한다 */
+void io_init(void)
+{
+  Signal(SIGPIPE, SIG_IGN);
+}
+
+void io_readinitb(io_rio_t *rp, int fd, char *buf, int size)
+{
+  rp->fd = fd;
+  rp->cnt = 0;
+  rp->bufptr = rp->buf = buf;
+  rp->size = size;
+}
+
+/* fd가 events만큼 준비되기를 기다린다. 시간을 넘기거나 오류면 -1 */
+static int io_wait(int fd, short events)
+{
+  struct pollfd pfd = { fd, events, 0 };
+  int rc;
+
+  __sync_fetch_and_add(&eagain_waits, 1);
+  while ((rc = poll(&pfd, 1, IO_TIMEOUT_MS)) < 0 && errno == EINTR)
+    ;
+  if (rc == 0) {
+    __sync_fetch_and_add(&timeouts, 1);
+    errno = ETIMEDOUT;
+  }
+  return rc > 0 ? 0 : -1;
+}
+
+/* io_writen - buf의 n바이트를 모두 쓰고 0을 반환. 상대가 끊었거나 오류면 -1 */
+int io_writen(int fd, void *buf, size_t n)
+{
+  char *p = buf;
+  ssize_t rc;
+  int sock = 1;
+
+  while (n > 0) {
+    rc = sock ? send(fd, p, n, MSG_NOSIGNAL) : write(fd, p, n);
+    if (rc < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOTSOCK && sock) { // 파이프나 파일
+        sock = 0;
+        continue;
+      }
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) && io_wait(fd, POLLOUT) == 0)
+        continue;
+      __sync_fetch_and_add(&write_errors, 1);
+      return -1;
+    }
+    p += rc;
+    n -= rc;
+  }
+  return 0;
+}
+
+/* fd에서 buf로 최대 n바이트를 한 번 읽는다 (EINTR, EAGAIN이면 다시). EOF면 0, 오류면 -1 */
+static ssize_t io_read_fd(int fd, char *buf, size_t n)
+{
+  ssize_t rc;
+
+  while ((rc = read(fd, buf, n)) < 0) {
+    if (errno == EINTR)
+      continue;
+    if ((errno == EAGAIN || errno == EWOULDBLOCK) && io_wait(fd, POLLIN) == 0)
+      continue;
+    __sync_fetch_and_add(&read_errors, 1);
+    return -1;
+  }
+  return rc;
+}
+
+/* 버퍼가 비었으면 한 번 읽어 채운다. 남은 바이트 수, EOF면 0, 오류면 -1 */
+static ssize_t io_fill(io_rio_t *rp)
+{
+  if (rp->cnt <= 0) {
+    if ((rp->cnt = io_read_fd(rp->fd, rp->buf, rp->size)) <= 0)
+      return rp->cnt;
+    rp->bufptr = rp->buf;
+  }
+  return rp->cnt;
+}
+
+/*
+ * 버퍼에서 최대 n바이트를 꺼낸다 (csapp의 rio_read). 버퍼가 비었고 n이 버퍼보다 크면
+ * 버퍼를 거치지 않고 buf로 바로 읽는다. EOF면 0, 오류면 -1
+ */
+static ssize_t io_read(io_rio_t *rp, char *buf, size_t n)
+{
+  ssize_t cnt;
+
+  if (rp->cnt <= 0 && n >= (size_t)rp->size)
+    return io_read_fd(rp->fd, buf, n);
+  if ((cnt = io_fill(rp)) <= 0)
+    return cnt;
+
+  cnt = n < (size_t)rp->cnt ? (ssize_t)n : rp->cnt;
+  memcpy(buf, rp->bufptr, cnt);
+  rp->bufptr += cnt;
+  rp->cnt -= cnt;
+  return cnt;
+}
+
+/* io_readnb - 최대 n바이트를 읽어 읽은 바이트 수를 반환 (EOF면 n보다 적다). 오류면 -1 */
+ssize_t io_readnb(io_rio_t *rp, void *buf, size_t n)
+{
+  char *p = buf;
+  size_t left = n;
+  ssize_t rc;
+
+  while (left > 0) {
+    if ((rc = io_read(rp, p, left)) < 0)
+      return -1;
+    if (rc == 0)
+      break;
+    left -= rc;
+    p += rc;
+  }
+  return n - left;
+}
+
+/* io_readlineb - 한 줄(최대 maxlen - 1바이트)을 읽어 '\0'으로 끝내고 길이를 반환. EOF면 0, 오류면 -1 */
+ssize_t io_readlineb(io_rio_t *rp, void *buf, size_t maxlen)
+{
+  char *p = buf, c;
+  size_t n;
+  ssize_t rc;
+
+  for (n = 1; n < maxlen; n++) {
+    if ((rc = io_read(rp, &c, 1)) < 0)
+      return -1;
+    if (rc == 0) {
+      if (n == 1)
+        return 0; // 읽은 것 없이 EOF
+      break;
+    }
+    *p++ = c;
+    if (c == '\n') {
+      n++;
+      break;
+    }
+  }
+  *p = '\0';
+  return n - 1;
+}
+
+/*
+ * io_readline - 한 줄을 line에 읽어 '\0'으로 끝내고 길이를 반환. line은 줄이 들어가도록
+ * maxlen까지 키우고, 그보다 긴 줄은 maxlen - 1바이트에서 자른다 (나머지는 다음 줄로 읽힌다).
+ * EOF면 0, 오류나 메모리 부족이면 -1
+ */
+ssize_t io_readline(io_rio_t *rp, growbuf_t *line, size_t maxlen)
+{
+  size_t n = 0, take;
+  ssize_t rc;
+  char *nl;
+
+  while (1) {
+    if ((rc = io_fill(rp)) <= 0) {
+      if (rc < 0 || n == 0)
+        return rc;
+      break; // 줄 중간에서 EOF
+    }
+    nl = memchr(rp->bufptr, '\n', rp->cnt);
+    take = nl ? (size_t)(nl - rp->bufptr + 1) : (size_t)rp->cnt;
+    if (n + take + 1 > maxlen)
+      take = maxlen - 1 - n;
+    if (growbuf_reserve(line, n + take + 1) < 0)
+      return -1;
+    memcpy(line->ptr + n, rp->bufptr, take);
+    rp->bufptr += take;
+    rp->cnt -= take;
+    n += take;
+    if (line->ptr[n - 1] == '\n' || n == maxlen - 1)
+      break;
+  }
+  line->ptr[n] = '\0';
+  return n;
+}
+
+int io_stats(char *buf, int size)
+{
+  int len = snprintf(buf, size,
+                     "io_read_errors %lu\n"
+                     "io_write_errors %lu\n"
+                     "io_eagain_waits %lu\n"
+                     "io_timeouts %lu\n",
+                     __atomic_load_n(&read_errors, __ATOMIC_RELAXED),
+                     __atomic_load_n(&write_errors, __ATOMIC_RELAXED),
+                     __atomic_load_n(&eagain_waits, __ATOMIC_RELAXED),
+                     __atomic_load_n(&timeouts, __ATOMIC_RELAXED));
+  return len < size ? len : size;
+}
@@ -0,0 +1,39 @@
+/*
+ * io.h - 연결마다 오류를 돌려주는 프록시 I/O 계층
+ *
+ * csapp의 Rio_* 래퍼는 오류가 나면 unix_error로 프로세스를 끝내므로, 클라이언트 하나가
+ * 연결을 끊기만 해도(EPIPE, ECONNRESET) 프록시 전체와 캐시가 사라진다. 여기 함수들은
+ * rio와 같은 방식으로 버퍼링하면서 오류를 -1(errno 설정)로 돌려주고, 호출자는 그 연결만 정리한다.
+ * 읽기 버퍼는 호출자가 준다 (연결 스레드는 bufpool에서 빌린 버퍼).
+ *
+ * 쓰기는 MSG_NOSIGNAL로 보내고 io_init이 SIGPIPE도 무시하게 하므로 끊긴 소켓에 써도 신호로
+ * 죽지 않는다. 논블로킹 소켓이면 EAGAIN에서 poll로 IO_TIMEOUT_MS까지 기다렸다가 이어서
+ * 읽고 쓰며, 시간을 넘기면 ETIMEDOUT으로 실패한다.
+ */
+#ifndef __IO_H__
+#define __IO_H__
+
+#include "csapp.h"
+#include "bufpool.h"
+
+#define IO_TIMEOUT_MS 30000 // EAGAIN 뒤 소켓이 준비되기를 기다리는 최대 시간
+
+/* 버퍼를 바깥에서 받는 rio_t */
+typedef struct
+{
+  int fd;
+  int cnt;      // 버퍼에 남은 바이트
+  char *bufptr; // 다음에 꺼낼 위치
+  char *buf;
+  int size;
+} io_rio_t;
+
+void io_init(void);
+void io_readinitb(io_rio_t *rp, int fd, char *buf, int size);
+int io_writen(int fd, void *buf, size_t n);
+ssize_t io_readnb(io_rio_t *rp, void *buf, size_t n);
+ssize_t io_readlineb(io_rio_t *rp, void *buf, size_t maxlen);
+ssize_t io_readline(io_rio_t *rp, growbuf_t *line, size_t maxlen);
+int io_stats(char *buf, int size);
+
+#endif /* __IO_H__ */
@@ -0,0 +1,219 @@
+/*
+ * l1cache.c - CPU별 직접 사상 1차 캐시
+ *
+ * 락 순서: CPU 락 → 샤드 락. 샤드 락을 잡은 채로 CPU 락을 잡는 곳은 없다.
+ * 적중 경로(l1_find)는 어느 락도 잡지 않는다.
+ */
+#include "l1cache.h"
+
+/* csapp.h가 _GNU_SOURCE와 충돌하므로 sched.h의 GNU 확장 선언을 직접 둔다 */
+int sched_getcpu(void);
+
+typedef struct
+{
+  web_object_t *web_object; // 잡고 있는 공유 캐시 참조 (NULL이면 빈 슬롯). 읽기는 락 없이
+  web_object_t *retired;    // 슬롯에서 뗐지만 아직 읽는 스레드가 있을 수 있는 객체
+  uint64_t retired_epoch;   // retired를 뗀 시점의 에포크
+  unsigned hits;            // 마지막 정리 이후 적중했으면 1
+} l1_slot_t;
+
+typedef struct
+{
+  pthread_mutex_t lock; // 슬롯을 채우거나 비울 때만 잡는다
+  l1_slot_t slots[L1_SLOTS];
+  unsigned long hits, misses, fills, invalidated;
+} __attribute__((aligned(64))) l1_cpu_t;
+
+static l1_cpu_t *cpus;
+static int ncpus;
+
+static l1_cpu_t *current_cpu(void)
+{
+  int cpu = sched_getcpu();
+
+  return &cpus[(cpu < 0 ? 0 : cpu) % ncpus];
+}
+
+/* 보류한 참조가 없거나, 에포크가 두 번 넘어가 돌려줬으면 1. CPU 락 아래에서 호출 */
+static int release_retired(l1_slot_t *slot)
+{
+  if (!slot->retired)
+    return 1;
+  if (epoch_current() < slot->retired_epoch + 2)
+    return 0;
+  release_cache(slot->retired);
+  slot->retired = NULL;
+  return 1;
+}
+
+/*
+ * 슬롯을 비우고 잡고 있던 참조를 보류한다. 앞서 보류한 참조를 아직 돌려줄 수 없으면
+ * 비우지 않고 0. CPU 락 아래에서 호출
+ */
+static int retire_slot(l1_slot_t *slot)
+{
+  if (!release_retired(slot))
+    return 0;
+  slot->retired = slot->web_object;
+  __atomic_store_n(&slot->web_object, NULL, __ATOMIC_RELEASE);
+  slot->hits = 0;
+  // 슬롯을 비운 것이 보이기 전에 에포크를 읽으면, 그 에포크에 들어와 아직 옛 객체를
+  // 보는 스레드가 있는데도 한 에포크 일찍 돌려줄 수 있다
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  slot->retired_epoch = epoch_current();
+  return 1;
+}
+
+/* 공유 캐시에서 빠졌거나 만료됐거나 밴에 걸렸으면 1 */
+static int stale(web_object_t *web_object, time_t now)
+{
+  return __atomic_load_n(&web_object->evicted, __ATOMIC_ACQUIRE) ||
+         (web_object->expires && web_object->expires <= now) ||
+         ban_check(web_object->key, web_object->key_len, web_object->cached_at,
+                   OBJECT_TAGS(web_object), web_object->ntags);
+}
+
+/*
+ * 매초 모든 CPU의 슬롯을 돌며 공유 캐시에서 빠진 객체를 떼고 보류한 참조를 돌려주며,
+ * 그 사이 L1에서 적중한 객체는 공유 LRU 앞으로 올린다.
+ */
+static void *l1_thread(void *vargp)
+{
+  web_object_t *touch[L1_SLOTS];
+  int c, i, ntouch;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    sleep(1);
+    for (c = 0; c < ncpus; c++) {
+      l1_cpu_t *cpu = &cpus[c];
+      time_t now = time(NULL);
+
+      ntouch = 0;
+      pthread_mutex_lock(&cpu->lock);
+      for (i = 0; i < L1_SLOTS; i++) {
+        l1_slot_t *slot = &cpu->slots[i];
+        release_retired(slot);
+        if (!slot->web_object)
+          continue;
+        if (stale(slot->web_object, now)) {
+          if (retire_slot(slot))
+            cpu->invalidated++;
+        } else if (__atomic_load_n(&slot->hits, __ATOMIC_RELAXED)) {
+          __atomic_store_n(&slot->hits, 0, __ATOMIC_RELAXED);
+          touch[ntouch++] = slot->web_object;
+          cache_hold(slot->web_object); // 락을 푼 뒤 올리는 동안 슬롯이 비워져도 안전하도록
+        }
+      }
+      pthread_mutex_unlock(&cpu->lock);
+
+      for (i = 0; i < ntouch; i++)
+        cache_touch(touch[i]);
+    }
+  }
+  return NULL;
+}
+
+/* l1_start - CPU별 슬롯을 만들고 정리 스레드를 띄운다. 부르지 않으면 L1은 꺼져 있다 */
+void l1_start(void)
+{
+  pthread_t tid;
+  int i;
+
+  ncpus = sysconf(_SC_NPROCESSORS_CONF);
+  if (ncpus < 1)
+    ncpus = 1;
+  if (ncpus > L1_MAX_CPUS)
+    ncpus = L1_MAX_CPUS;
+  if (posix_memalign((void **)&cpus, 64, ncpus * sizeof(l1_cpu_t)))
+    unix_error("l1 cache alloc error");
+  memset(cpus, 0, ncpus * sizeof(l1_cpu_t));
+  for (i = 0; i < ncpus; i++)
+    pthread_mutex_init(&cpus[i].lock, NULL);
+  Pthread_create(&tid, NULL, l1_thread, NULL);
+}
+
+/*
+ * l1_find - 지금 CPU의 슬롯에서 키를 찾아 객체를 돌려준다. epoch_enter와 epoch_leave 사이에서
+ * 부르고, 돌려받은 객체는 epoch_leave 전까지만 쓴다. 락도 refcnt도 건드리지 않는다.
+ * 없거나 무효가 된 객체면 NULL이고 (떼는 일은 정리 스레드가 한다), 호출자는 공유 캐시로 넘어간다.
+ */
+web_object_t *l1_find(cache_key_t *key)
+{
+  web_object_t *web_object;
+  l1_cpu_t *cpu;
+  l1_slot_t *slot;
+
+  if (!cpus)
+    return NULL;
+  cpu = current_cpu();
+  slot = &cpu->slots[key->hash & (L1_SLOTS - 1)];
+
+  web_object = __atomic_load_n(&slot->web_object, __ATOMIC_ACQUIRE);
+  if (web_object && web_object->hash == key->hash && web_object->key_len == key->len &&
+      !memcmp(web_object->key, key->str, key->len) && !stale(web_object, time(NULL))) {
+    if (!__atomic_load_n(&slot->hits, __ATOMIC_RELAXED))
+      __atomic_store_n(&slot->hits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&cpu->hits, 1, __ATOMIC_RELAXED);
+    return web_object;
+  }
+  __atomic_fetch_add(&cpu->misses, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+/*
+ * l1_offer - 공유 캐시에서 적중한 객체를 지금 CPU의 L1에 올려 본다.
+ * 작고 충분히 자주 요청된 객체만 참조를 하나 더 잡아 슬롯에 넣는다. 호출자의 참조는 그대로다.
+ */
+void l1_offer(web_object_t *web_object)
+{
+  l1_cpu_t *cpu;
+  l1_slot_t *slot;
+
+  if (!cpus || web_object->content_length > L1_MAX_OBJECT)
+    return;
+  cpu = current_cpu();
+  slot = &cpu->slots[web_object->hash & (L1_SLOTS - 1)];
+  if (__atomic_load_n(&slot->web_object, __ATOMIC_RELAXED) == web_object)
+    return; // 같은 CPU의 다른 스레드가 이미 올렸다 (락 없이 본 값이라 틀려도 아래에서 걸러진다)
+  if (!cache_hold_hot(web_object, L1_MIN_FREQ))
+    return;
+
+  pthread_mutex_lock(&cpu->lock);
+  if (slot->web_object == web_object || (slot->web_object && !retire_slot(slot))) {
+    pthread_mutex_unlock(&cpu->lock);
+    release_cache(web_object);
+    return;
+  }
+  __atomic_store_n(&slot->web_object, web_object, __ATOMIC_RELEASE);
+  cpu->fills++;
+  pthread_mutex_unlock(&cpu->lock);
+}
+
+int l1_stats(char *buf, int size)
+{
+  unsigned long hits = 0, misses = 0, fills = 0, invalidated = 0, objects = 0;
+  int c, i, len;
+
+  if (!cpus)
+    return 0;
+  for (c = 0; c < ncpus; c++) {
+    pthread_mutex_lock(&cpus[c].lock);
+    hits += __atomic_load_n(&cpus[c].hits, __ATOMIC_RELAXED);
+    misses += __atomic_load_n(&cpus[c].misses, __ATOMIC_RELAXED);
+    fills += cpus[c].fills;
+    invalidated += cpus[c].invalidated;
+    for (i = 0; i < L1_SLOTS; i++)
+      objects += cpus[c].slots[i].web_object != NULL;
+    pthread_mutex_unlock(&cpus[c].lock);
+  }
+  len = snprintf(buf, size,
+                 "l1_cpus %d\n"
+                 "l1_objects %lu\n"
+                 "l1_hits %lu\n"
+                 "l1_misses %lu\n"
+                 "l1_fills %lu\n"
+                 "l1_invalidated %lu\n",
+                 ncpus, objects, hits, misses, fills, invalidated);
+  return len < size ? len : size;
+}
@@ -0,0 +1,29 @@
+/*
+ * l1cache.h - 가장 자주 요청되는 객체를 CPU마다 따로 잡아 두는 작은 1차 캐시
+ *
+ * 연결마다 스레드를 새로 만들므로 스레드 지역 캐시는 요청 하나가 끝나면 사라진다.
+ * 대신 CPU마다 직접 사상(direct-mapped) 슬롯 배열을 두고, 같은 CPU에서 도는 스레드들이
+ * 그 CPU의 슬롯만 보게 한다. 적중은 에포크 안에서 슬롯을 읽기만 하므로 락도, 객체
+ * refcnt도 건드리지 않는다. CPU 락은 슬롯을 채우거나 비우는 쪽만 잡는다.
+ *
+ * 슬롯은 공유 캐시 객체의 참조를 하나 잡고 있다. 객체를 슬롯에서 떼어도 락 없이 읽는
+ * 스레드가 아직 볼 수 있으므로, 그 참조는 슬롯에 보류해 두었다가 에포크가 두 번 넘어간
+ * 뒤에 돌려준다. 매초 도는 정리 스레드가 무효가 된 객체를 떼고 보류한 참조를 돌려주며,
+ * L1에서 적중한 객체를 공유 LRU 앞으로 올려 공유 캐시에서 차갑게 보이지 않게 한다.
+ */
+#ifndef __L1CACHE_H__
+#define __L1CACHE_H__
+
+#include "cache.h"
+
+#define L1_SLOTS 256            // CPU당 슬롯 수 (2의 거듭제곱)
+#define L1_MAX_CPUS 256
+#define L1_MAX_OBJECT (16 * 1024) // 이보다 큰 객체는 L1에 두지 않는다
+#define L1_MIN_FREQ 4           // 입장 필터 스케치 추정 빈도가 이 이상인 객체만 올린다
+
+void l1_start(void);
+web_object_t *l1_find(cache_key_t *key);
+void l1_offer(web_object_t *web_object);
+int l1_stats(char *buf, int size);
+
+#endif /* __L1CACHE_H__ */
@@ -1,28 +1,133 @@
 #include <stdio.h>
+#include <sys/sendfile.h>
 #include "csapp.h"
+#include "cache.h"
+#include "query_rules.h"
+#include "disk.h"
+#include "snapshot.h"
+#include "shmcache.h"
+#include "upgrade.h"
+#include "l1cache.h"
+#include "gzip.h"
+#include "io.h"
+#include "arena.h"
+#include "relay.h"
 
- typedef struct web_object_t
-    {
-      char path[MAXLINE];
-      int content_length;
-      char *response_ptr;
-      struct web_object_t *prev, *next;
-    } web_object_t;
+/* Range 요청 처리 */
+#define MAX_RANGES 16          // 이보다 많은 구간을 요청하면 Range를 무시하고 전체 전송
+#define RANGE_FILL_ON_MISS 1   // 미스 시 206을 중계하면서 전체 객체를 백그라운드로 받아 캐싱
+#define EPOCH_SEND_MAX (16 * 1024) // 이 이하의 객체는 락 없이 찾아 에포크 안에서 바로 보낸다
 
-web_object_t *rootp = NULL;
-web_object_t *lastp = NULL;
-int total_cache_size = 0;
+/*
+ * 캐시에 채우는 응답은 원 서버에서 FILL_CHUNK씩 받는 대로 클라이언트에 중계한다. 클라이언트가
+ * 중간에 끊으면 남은 본문이 fill_continue_max 이하일 때만 끝까지 받아 캐시에 넣고, 아니면
+ * 원 서버 연결을 바로 닫는다. -F로 바꿀 수 있고 0이면 항상 닫는다.
+ */
+#define FILL_CHUNK (16 * 1024)
+#define FILL_CONTINUE_MAX (64 * 1024)
 
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+/*
+ * 네거티브 캐시 TTL(초). 항목은 상태 코드, "5xx" 같은 상태 분류, connect(연결 실패),
+ * dns(호스트 조회 실패)이고 0이면 캐싱하지 않는다. -N으로 일부만 바꿀 수 있다.
+ */
+#define NEGATIVE_TTL_DEFAULT "404=10,410=60,5xx=5,connect=5,dns=30"
+
+/*
+ * 연결 스레드의 스택. 요청마다 쓰는 버퍼는 스택 대신 bufpool에서 빌리므로(conn_bufs_t)
+ * 가장 깊은 호출 경로도 이 안에 여유 있게 들어간다.
+ */
+#define THREAD_STACK_SIZE (64 * 1024)
+#define RANGE_HDR_MAX 1024       // 이보다 긴 Range 값은 무시하고 전체 전송
+#define SURROGATE_KEY_MAX (BAN_MAX_TAGS * (BAN_MAX_TAG_LEN + 1)) // 넘으면 어차피 태그를 다 기록할 수 없다
+
+typedef struct
+{
+  long start, end; // 양 끝 포함
+} byte_range_t;
+
+/* 전송할 본문: 메모리 버퍼(mem) 또는 파일의 한 구간(fd, offset) */
+typedef struct
+{
+  char *mem;
+  int fd;
+  off_t offset;
+} body_src_t;
+
+typedef struct range_fill_t
+{
+  char hostname[MAXLINE], port[MAXLINE], path[MAXLINE];
+  cache_key_t key;
+  struct range_fill_t *next;
+} range_fill_t;
+
+/* 원 서버 본문을 받을 캐시 객체: -m이면 공유 메모리 세그먼트에, 아니면 프로세스 캐시에 만든다 */
+typedef struct
+{
+  web_object_t *web_object;
+  shm_ref_t shm;
+  cache_key_t *key;     // 객체의 키 (Vary 응답이면 변형 키)
+  cache_key_t *primary; // Vary 응답이면 색인을 걸 주 키, 아니면 NULL
+  char *vary;           // 정규화한 Vary 목록 (parse_vary)
+  int reserved;         // 중계 예산에서 잡은 바이트 (relay.h)
+} cache_fill_t;
+
+/*
+ * 연결 하나가 쓰는 버퍼. 필요해질 때 bufpool에서 작은 크기로 빌리고, 요청 줄이나 헤더가
+ * 길 때만 키운다. 그 밖에 요청 동안만 쓰는 메모리는 arena에서 받는다. 연결이 끝나면
+ * thread가 모두 돌려준다.
+ */
+typedef struct
+{
+  growbuf_t client_in, server_in; // 클라이언트/원 서버 읽기 버퍼 (io_rio_t)
+  growbuf_t line;                 // 요청 줄, 헤더 한 줄
+  growbuf_t hdrs;                 // 원 서버로 보낼 요청 헤더
+  growbuf_t resp_hdrs;            // 원 서버 응답 헤더
+  arena_t arena;
+} conn_bufs_t;
+
+int negative_ttls[600];              // 상태 코드별 TTL
+int connect_fail_ttl, dns_fail_ttl;
+int fill_continue_max = FILL_CONTINUE_MAX;
+unsigned long fill_client_aborts, fill_continued; // 채우는 중에 끊긴 클라이언트 / 그중 끝까지 받은 것
+
+/* 이 스레드가 처리 중인 요청의 arena. 요청 처리 깊은 곳(오류 응답, gzip 전송)에서 쓴다 */
+static __thread arena_t *request_arena;
+
+range_fill_t *range_fills = NULL; // 진행 중인 백그라운드 채우기 목록
+pthread_mutex_t range_fill_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void *thread(void *vargp);
-web_object_t *find_cache(char *path);
-void send_cache(web_object_t *web_object, int clientfd);
-void read_cache(web_object_t *web_object);
-void write_cache(web_object_t *web_object);
-void handle_client(int clientfd);
+void send_cache(web_object_t *web_object, int clientfd, char *range, int gzip_ok, char *vary_hdr,
+                int head);
+void send_gzip(web_object_t *web_object, int clientfd, char *range, int gzip_ok, char *extra_hdrs,
+               int head);
+int header_length(char *resp, int len);
+cache_key_t *use_variant(web_object_t *index, cache_key_t *key, char *hdrs, cache_key_t **variant,
+                         char *vary_hdr);
+void handle_client(int clientfd, conn_bufs_t *bufs);
+void free_conn_bufs(conn_bufs_t *bufs);
+void parse_uri(char *uri, char *hostname, char *port, char *path);
+int read_requesthdrs(io_rio_t *rp, growbuf_t *line, growbuf_t *hdrs, char *range, int *gzip_ok);
+int send_requesthdrs(int serverfd, char *hdrs, char *hostname);
+void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
+int build_error(char *buf, char *cause, char *errnum, char *shortmsg, char *longmsg);
+int set_negative_ttls(char *spec);
+web_object_t *alloc_negative(cache_key_t *key, int status, int ttl, char *content_type, int length);
+int parse_range(char *range, long length, byte_range_t *ranges);
+int send_body(int clientfd, body_src_t *body, long start, long len);
+void send_object(int clientfd, body_src_t *body, int length, char *content_type, char *range,
+                 char *extra_hdrs);
+void start_range_fill(char *hostname, char *port, char *path, cache_key_t *key);
+void *range_fill_thread(void *vargp);
+void handle_local(int clientfd, char *uri);
+void handle_purge(int clientfd, io_rio_t *rp, conn_bufs_t *bufs, char *method, char *uri);
+int is_loopback_peer(int fd);
+void send_text(int clientfd, char *body, int len);
+int header_value(char *p, char *value, int size);
+char *begin_fill(cache_fill_t *fill, cache_key_t *key, cache_key_t *primary, char *vary,
+                 char *content_type, int length, uint32_t *tags, int ntags);
+void commit_fill(cache_fill_t *fill);
+void abort_fill(cache_fill_t *fill);
 
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr =
@@ -31,125 +136,629 @@ static const char *user_agent_hdr =
 
 int main(int argc, char **argv)
 {
-  int listenfd, *connfdp;
+  int listenfd, connfd;
   socklen_t clientlen;
   struct sockaddr_storage clientaddr;
   pthread_t tid;
+  pthread_attr_t attr;
+  sigset_t mask;
+  int opt;
+
+  char *disk_dir = NULL, *snapshot_path = NULL, *shm_name = NULL;
+  size_t disk_mb = 1024, shm_mb = 64;
+  int snapshot_interval = 0;
+
+  io_init();
+  set_negative_ttls(NEGATIVE_TTL_DEFAULT);
+
+  while((opt = getopt(argc, argv, "q:d:D:s:S:m:M:AN:F:R:")) != -1){
+    switch(opt){
+    case 'q': // 쿼리 스트링 정규화 규칙 파일
+      if(load_query_rules(optarg) < 0)
+        exit(1);
+      break;
+    case 'd': // 디스크 2차 캐시 디렉터리
+      disk_dir = optarg;
+      break;
+    case 'D': // 디스크 캐시 크기 (MB)
+      disk_mb = atol(optarg);
+      break;
+    case 's': // 캐시 스냅샷 파일
+      snapshot_path = optarg;
+      break;
+    case 'S': // 주기적 스냅샷 간격 (초)
+      snapshot_interval = atoi(optarg);
+      break;
+    case 'm': // 프로세스 간 공유 메모리 캐시 이름
+      shm_name = optarg;
+      break;
+    case 'M': // 공유 메모리 캐시 크기 (MB)
+      shm_mb = atol(optarg);
+      break;
+    case 'A': // 입장 필터 없이 모든 응답을 캐시에 넣는다
+      cache_set_admission(0);
+      break;
+    case 'N': // 네거티브 캐시 TTL (예: 404=30,5xx=0,connect=10)
+      if(set_negative_ttls(optarg) < 0){
+        fprintf(stderr, "bad negative TTL spec: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'F': // 클라이언트가 끊어도 끝까지 받아 캐싱할 남은 본문 크기 (바이트)
+      fill_continue_max = atoi(optarg);
+      break;
+    case 'R': // 원 서버 응답 중계에 쓰는 메모리 예산 (MB)
+      relay_set_budget((size_t)atol(optarg) << 20);
+      break;
+    default:
+      argc = 0; // usage 출력
+    }
+  }
+
+  if(argc - optind != 1){
+    fprintf(stderr, "usage: %s [-q query_rules] [-d disk_dir [-D disk_mb]] "
+                    "[-s snapshot [-S seconds]] [-m shm_name [-M shm_mb]] "
+                    "[-A] [-N status=ttl,...] [-F fill_continue_bytes] [-R relay_mb] <port>\n", argv[0]);
+    exit(1);
+  }
+
+  // 업그레이드로 시작했으면 이전 프로세스의 리스닝 소켓을 그대로 쓴다
+  if((listenfd = upgrade_listenfd()) < 0)
+    listenfd = Open_listenfd(argv[optind]);
 
-  if(argc != 2){
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
+  // 어떤 스레드보다 먼저 막아 두어야 SIGUSR2, SIGTERM이 sigwait하는 스레드로만 간다
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR2);
+  if(snapshot_path)
+    sigaddset(&mask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  upgrade_start(argv, listenfd);
+  if(snapshot_path){
+    if(snapshot_open(snapshot_path) < 0){
+      fprintf(stderr, "cannot open snapshot %s: %s\n", snapshot_path, strerror(errno));
+      exit(1);
+    }
+    snapshot_start(snapshot_interval);
+  }
+  cache_start_sweeper();
+  cache_start_evictor();
+  l1_start();
+  gzip_start();
+
+  if(disk_dir && disk_init(disk_dir, disk_mb << 20) < 0)
+    exit(1);
+
+  if(shm_name && shm_cache_open(shm_name, shm_mb << 20) < 0){
+    fprintf(stderr, "cannot open shared cache %s: %s\n", shm_name, strerror(errno));
     exit(1);
   }
 
-  listenfd = Open_listenfd(argv[1]);
+  upgrade_ready();
 
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
   while(1) {
     clientlen = sizeof(clientaddr);
-    connfdp = Malloc(sizeof(int));
-    *connfdp = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-    Pthread_create(&tid, NULL, thread, connfdp);
+    if((connfd = upgrade_accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0)
+      upgrade_drain(); // 새 프로세스에 넘겼다: 처리 중인 요청만 끝내고 종료
+    upgrade_enter();
+    Pthread_create(&tid, &attr, thread, (void *)(long)connfd); // 값으로 넘겨 malloc을 피한다
   }
 }
 
 void *thread(void *vargp){
-  int connfd = *((int *)vargp);
+  int connfd = (int)(long)vargp;
+  conn_bufs_t bufs;
   Pthread_detach(pthread_self());
-  Free(vargp);
 
-  handle_client(connfd);
+  memset(&bufs, 0, sizeof(bufs));
+  request_arena = &bufs.arena;
+  handle_client(connfd, &bufs);
+  free_conn_bufs(&bufs);
   Close(connfd);
+  upgrade_leave();
   return NULL;
 }
 
-void handle_client(int clientfd) {
-  rio_t request_rio, response_rio;
-  char request_buf[MAXLINE];
-  char method[MAXLINE] = {0}, uri[MAXLINE] = {0};
-  char hostname[MAXLINE], port[MAXLINE], path[MAXLINE];
+/* free_conn_bufs - 연결 버퍼를 모두 풀에 돌려준다 */
+void free_conn_bufs(conn_bufs_t *bufs)
+{
+  growbuf_free(&bufs->client_in);
+  growbuf_free(&bufs->server_in);
+  growbuf_free(&bufs->line);
+  growbuf_free(&bufs->hdrs);
+  growbuf_free(&bufs->resp_hdrs);
+  arena_free(&bufs->arena);
+}
 
-  Rio_readinitb(&request_rio, clientfd);
+void handle_client(int clientfd, conn_bufs_t *bufs) {
+  io_rio_t request_rio, response_rio;
+  char *request_buf, *hdrs, range[RANGE_HDR_MAX];
+  char *method, *uri, *hostname, *port, *path, *keypath;
+  cache_key_t key, *variant = NULL, *lookup = &key; // Vary 색인이 있으면 변형 키로 찾는다
+  char vary_hdr[VARY_NAMES_MAX + 16] = "";  // 변형을 보낼 때 붙일 Vary 헤더
+  int gzip_ok, is_head;
+  size_t field;
+
+  if (growbuf_reserve(&bufs->client_in, BUFPOOL_SMALL) < 0)
+    return;
+  io_readinitb(&request_rio, clientfd, bufs->client_in.ptr, bufs->client_in.size);
 
   // 요청 라인 읽기
-  if (!Rio_readlineb(&request_rio, request_buf, MAXLINE)) {
+  if (io_readline(&request_rio, &bufs->line, MAXLINE) <= 0) {
     return;
   }
+  request_buf = bufs->line.ptr;
   printf("Request headers:\n%s", request_buf);
 
+  // 요청 줄에서 나오는 문자열은 요청 줄보다 길 수 없다
+  field = strlen(request_buf) + 1;
+  method = arena_alloc(&bufs->arena, field);
+  uri = arena_alloc(&bufs->arena, field);
+  hostname = arena_alloc(&bufs->arena, field);
+  port = arena_alloc(&bufs->arena, field);
+  path = arena_alloc(&bufs->arena, field);
+  if (!(keypath = arena_alloc(&bufs->arena, field)))
+    return; // 앞의 것이 실패했으면 이것도 실패한다
+  method[0] = uri[0] = '\0';
+
   // method와 uri 파싱 & 검사
   if (sscanf(request_buf, "%s %s", method, uri) != 2 || strlen(uri) == 0) {
     clienterror(clientfd, request_buf, "400", "Bad Request", "Malformed or empty request line");
     return;
   }
 
+  // 캐시 무효화 요청 (PURGE: 정확한 URL 또는 Surrogate-Key 태그, BAN: URL 접두사)
+  if (!strcasecmp(method, "PURGE") || !strcasecmp(method, "BAN")) {
+    handle_purge(clientfd, &request_rio, bufs, method, uri);
+    return;
+  }
+
   // 지원하지 않는 메서드인 경우
   if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD")) {
     clienterror(clientfd, method, "501", "Not implemented", "Proxy does not implement this method");
     return;
   }
+  is_head = !strcasecmp(method, "HEAD"); // 적중이면 캐시된 GET 응답의 헤더만 보낸다
+
+  // 프록시 자신에게 온 요청 (origin-form)
+  if (uri[0] == '/') {
+    handle_local(clientfd, uri);
+    return;
+  }
 
-  // URI 파싱
+  // URI 파싱 + 쿼리 정규화 규칙을 적용한 캐시 키 생성
   parse_uri(uri, hostname, port, path);
+  query_rule_t *rule = normalize_query(hostname, port, path, keypath);
+  build_cache_key(&key, hostname, port, keypath);
 
-  //  캐시 확인
-  web_object_t *cached_object = find_cache(path);
+  // 요청 헤더는 캐시 확인 전에 읽어 둔다 (Range, Accept-Encoding 처리에 필요)
+  if (read_requesthdrs(&request_rio, &bufs->line, &bufs->hdrs, range, &gzip_ok) < 0) {
+    clienterror(clientfd, uri, "431", "Request Header Fields Too Large", "Request headers too large");
+    return;
+  }
+  hdrs = bufs->hdrs.ptr;
+
+  // 락 없는 조회. 지금 CPU의 L1 슬롯을 먼저 보고, 없으면 공유 인덱스를 본다.
+  // 작은 객체는 소켓 버퍼에 바로 들어가므로 에포크를 오래 붙잡지 않는다
+  // (압축을 풀어 보내야 하는 gzip 객체는 참조를 잡는 경로로 보낸다)
+  // Vary 색인을 만나면 요청 헤더 값으로 만든 변형 키로 한 번 더 찾는다
+  web_object_t *cached_object, *l1_object = NULL;
+  if (epoch_enter()) {
+    cached_object = l1_object = l1_find(&key);
+    if (!cached_object)
+      cached_object = cache_lookup(&key);
+    if (cached_object && cached_object->vary == VARY_INDEX) {
+      if (!(lookup = use_variant(cached_object, &key, hdrs, &variant, vary_hdr))) {
+        epoch_leave();
+        return;
+      }
+      cached_object = cache_lookup(lookup);
+    }
+    if (cached_object && cached_object->content_length <= EPOCH_SEND_MAX &&
+        (cached_object->encoding == OBJECT_IDENTITY || (gzip_ok && !range[0]))) {
+      count_query_rule(rule, 1);
+      send_cache(cached_object, clientfd, range, gzip_ok, vary_hdr, is_head);
+      if (lookup == &key && cached_object != l1_object) // L1은 주 키로만 찾는다
+        l1_offer(cached_object);
+      epoch_leave();
+      return;
+    }
+    epoch_leave();
+  }
+
+  //  캐시 확인 (없으면 재시작 전 스냅샷에서 올려 본다)
+  cached_object = find_cache(lookup);
+  if (cached_object && cached_object->vary == VARY_INDEX) {
+    lookup = use_variant(cached_object, &key, hdrs, &variant, vary_hdr);
+    read_cache(cached_object);
+    if (!lookup)
+      return;
+    cached_object = find_cache(lookup);
+  }
+  if (!cached_object && snapshot_promote(lookup))
+    cached_object = find_cache(lookup);
+  shm_ref_t shm_ref;
+  int shm_hit = !cached_object && shm_cache_find(lookup, &shm_ref);
+  count_query_rule(rule, cached_object != NULL || shm_hit);
   if (cached_object) {
-    send_cache(cached_object, clientfd);
+    send_cache(cached_object, clientfd, range, gzip_ok, vary_hdr, is_head);
+    if (lookup == &key)
+      l1_offer(cached_object);
     read_cache(cached_object);
     return;
   }
 
-  // 서버 연결
-  int serverfd = Open_clientfd(hostname, port);
+  // 다른 프로세스와 함께 쓰는 공유 메모리 캐시 (세그먼트에서 바로 전송)
+  if (shm_hit) {
+    body_src_t body = { shm_ref.body, -1, 0 };
+    send_object(clientfd, is_head ? NULL : &body, shm_ref.length, shm_ref.content_type, range, NULL);
+    shm_cache_release(&shm_ref);
+    return;
+  }
+
+  // 디스크 캐시 확인 (세그먼트 파일에서 바로 전송)
+  disk_hit_t disk_hit;
+  if (disk_find(lookup, &disk_hit)) {
+    body_src_t body = { NULL, disk_hit.fd, disk_hit.offset };
+    send_object(clientfd, is_head ? NULL : &body, disk_hit.length, disk_hit.content_type, range, NULL);
+    disk_release(&disk_hit);
+    return;
+  }
+
+  // 서버 연결. 실패도 잠깐 캐싱해 두어 같은 요청이 DNS 조회와 연결 시도를 반복하지 않게 한다
+  int serverfd = open_clientfd(hostname, port);
   if (serverfd < 0) {
-    clienterror(clientfd, hostname, "502", "Bad Gateway", "Connection failed");
+    int dns_fail = (serverfd == -2);
+    char *errbuf = arena_alloc(&bufs->arena, field + MAXLINE);
+    if (!errbuf)
+      return;
+    int len = build_error(errbuf, hostname, "502", "Bad Gateway",
+                          dns_fail ? "Host not found" : "Connection failed");
+    io_writen(clientfd, errbuf, is_head ? header_length(errbuf, len) : len);
+
+    web_object_t *negative = alloc_negative(&key, 502, dns_fail ? dns_fail_ttl : connect_fail_ttl,
+                                            "text/html", len);
+    if (negative) {
+      memcpy(negative->response_ptr, errbuf, len);
+      write_cache(negative);
+      relay_release(len);
+    }
     return;
   }
 
-  // 요청 전송
-  sprintf(request_buf, "%s %s HTTP/1.0\r\n", method, path);
-  Rio_writen(serverfd, request_buf, strlen(request_buf));
-  read_requesthdrs(&request_rio, serverfd, hostname);
+  // 요청 전송. HEAD 미스도 GET으로 받아 캐시를 채우고, 클라이언트에는 헤더만 보낸다
+  if (growbuf_reserve(&bufs->line, field + 32) < 0 ||
+      growbuf_reserve(&bufs->server_in, BUFPOOL_SMALL) < 0) {
+    Close(serverfd);
+    return;
+  }
+  request_buf = bufs->line.ptr;
+  sprintf(request_buf, "GET %s HTTP/1.0\r\n", path);
+  if (io_writen(serverfd, request_buf, strlen(request_buf)) < 0 ||
+      send_requesthdrs(serverfd, hdrs, hostname) < 0) {
+    clienterror(clientfd, hostname, "502", "Bad Gateway", "Origin closed the connection");
+    Close(serverfd);
+    return;
+  }
 
-  // 응답 헤더 전송 + Content-Length 파싱
-  Rio_readinitb(&response_rio, serverfd);
-  int content_length = -1;
-  size_t n;
+  // 응답 헤더를 모아 두면서 상태 코드, Content-Length 등 파싱
+  io_readinitb(&response_rio, serverfd, bufs->server_in.ptr, bufs->server_in.size);
+  char *resp_hdrs, content_type[128] = "", surrogate_key[SURROGATE_KEY_MAX + 1] = "";
+  char vary_names[VARY_NAMES_MAX] = "";
+  int status = 0, content_length = -1, hdr_len = 0, streamed = 0, vary_star = 0, tags_ok = 1;
+  long range_total = -1;
+  ssize_t n;
 
-  while ((n = Rio_readlineb(&response_rio, request_buf, MAXLINE)) > 0) {
-    Rio_writen(clientfd, request_buf, n);
+  while ((n = io_readline(&response_rio, &bufs->line, MAXLINE)) > 0) {
+    request_buf = bufs->line.ptr;
+    if (!status)
+      sscanf(request_buf, "HTTP/%*s %d", &status);
 
     if (strncasecmp(request_buf, "Content-length:", 15) == 0) {
       content_length = atoi(request_buf + 15);
+    } else if (strncasecmp(request_buf, "Content-type:", 13) == 0) {
+      sscanf(request_buf + 13, " %127[^\r\n]", content_type);
+    } else if (strncasecmp(request_buf, "Surrogate-Key:", 14) == 0) {
+      tags_ok = header_value(request_buf + 14, surrogate_key, sizeof(surrogate_key)) == 0;
+    } else if (strncasecmp(request_buf, "Vary:", 5) == 0) {
+      if (parse_vary(request_buf + 5, vary_names) < 0)
+        vary_star = 1; // Vary: *는 캐싱하지 않는다
+    } else if (strncasecmp(request_buf, "Content-range:", 14) == 0) {
+      char *slash = strchr(request_buf, '/');
+      if (slash && slash[1] != '*')
+        range_total = atol(slash + 1);
+    }
+
+    // 헤더가 MAXBUF를 넘치면 그대로 중계 모드로 전환
+    if (streamed || hdr_len + n >= MAXBUF ||
+        growbuf_reserve(&bufs->resp_hdrs, hdr_len + n + 1) < 0) {
+      if (!streamed)
+        io_writen(clientfd, bufs->resp_hdrs.ptr, hdr_len);
+      streamed = 1;
+      io_writen(clientfd, request_buf, n);
+    } else {
+      memcpy(bufs->resp_hdrs.ptr + hdr_len, request_buf, n);
+      hdr_len += n;
     }
 
     if (strcmp(request_buf, "\r\n") == 0)
       break; // 헤더 종료
   }
 
-  // 본문 읽기 + 클라이언트 전송
-  if (strcasecmp(method, "HEAD") != 0 && content_length > 0) {
-    char *response_ptr = malloc(content_length);
-    if (!response_ptr) {
-      Close(serverfd);
-      return;
+  resp_hdrs = bufs->resp_hdrs.ptr;
+  int varies = vary_star || vary_names[0];
+  // 404, 410, 5xx 등은 상태 줄부터 응답 전체를 네거티브 항목으로 잠깐 캐싱 (Vary가 없을 때만).
+  // Range 요청의 응답은 Range 없는 요청에 다시 보낼 수 없으므로 캐싱하지 않는다
+  web_object_t *negative = NULL;
+  if (!streamed && !varies && !range[0] && status >= 400 && status < 600 && content_length >= 0)
+    negative = alloc_negative(&key, status, negative_ttls[status], content_type,
+                              hdr_len + content_length);
+  if (negative) {
+    memcpy(negative->response_ptr, resp_hdrs, hdr_len);
+    if (io_readnb(&response_rio, negative->response_ptr + hdr_len, content_length) != content_length) {
+      free_web_object(negative);
+    } else {
+      io_writen(clientfd, negative->response_ptr, is_head ? hdr_len : hdr_len + content_length);
+      write_cache(negative);
     }
+    relay_release(hdr_len + content_length);
+    Close(serverfd);
+    return;
+  }
 
-    Rio_readnb(&response_rio, response_ptr, content_length);
-    Rio_writen(clientfd, response_ptr, content_length);
+  cache_fill_t fill;
+  char *response_ptr = NULL;
+  uint32_t tags[BAN_MAX_TAGS];
+  int ntags = tags_ok ? ban_intern_tags(surrogate_key, tags) : -1; // 태그를 다 기록할 수 없으면 캐싱하지 않는다
 
-    // 캐싱
-    if (content_length <= MAX_OBJECT_SIZE) {
-      web_object_t *web_object = calloc(1, sizeof(web_object_t));
-      strcpy(web_object->path, path);
-      web_object->content_length = content_length;
-      web_object->response_ptr = response_ptr;
-      write_cache(web_object);
+  // 200 전체 응답이면 본문을 캐시 객체로 바로 받는다. Vary가 있으면 요청 헤더 값으로 만든 변형 키에
+  if (!streamed && !vary_star && status == 200 && ntags >= 0 &&
+      content_length > 0 && content_length <= MAX_OBJECT_SIZE) {
+    if (vary_names[0]) {
+      if (variant || (variant = arena_alloc(&bufs->arena, sizeof(cache_key_t)))) {
+        build_variant_key(variant, &key, vary_names, hdrs);
+        response_ptr = begin_fill(&fill, variant, &key, vary_names, content_type, content_length,
+                                  tags, ntags);
+      }
     } else {
-      free(response_ptr);
+      response_ptr = begin_fill(&fill, &key, NULL, NULL, content_type, content_length, tags, ntags);
+    }
+  }
+
+  // 캐싱하고, Range 요청이었다면 다 받은 뒤 캐시와 같은 방식으로 잘라서 전송
+  if (response_ptr) {
+    char *vary = fill.web_object ? gzip_vary(content_type) : NULL; // 나중에 gzip으로 바뀔 수 있다
+    int client_ok = !range[0], got;
+    ssize_t rc;
+
+    if (client_ok) // 빈 줄 앞에 Vary를 끼운다
+      client_ok = io_writen(clientfd, resp_hdrs, hdr_len - 2) == 0 &&
+                  (!vary || io_writen(clientfd, vary, strlen(vary)) == 0) &&
+                  io_writen(clientfd, "\r\n", 2) == 0;
+    if (!client_ok && !range[0])
+      __sync_fetch_and_add(&fill_client_aborts, 1);
+
+    for (got = 0; got < content_length; got += rc) {
+      if ((rc = io_readnb(&response_rio, response_ptr + got,
+                           content_length - got < FILL_CHUNK ? content_length - got : FILL_CHUNK)) <= 0)
+        break;
+      if (client_ok && !is_head && io_writen(clientfd, response_ptr + got, rc) < 0) {
+        client_ok = 0;
+        __sync_fetch_and_add(&fill_client_aborts, 1);
+      }
+      // 클라이언트 없이 받을 본문이 많으면 원 서버 연결을 바로 끊는다
+      if (!client_ok && !range[0] && content_length - got - rc > fill_continue_max)
+        break;
+    }
+    if (got < content_length) {
+      abort_fill(&fill);
+      Close(serverfd);
+      return;
+    }
+    if (!client_ok && !range[0])
+      __sync_fetch_and_add(&fill_continued, 1);
+
+    if (range[0]) {
+      body_src_t body = { response_ptr, -1, 0 };
+      send_object(clientfd, is_head ? NULL : &body, content_length, content_type, range, vary);
     }
+    commit_fill(&fill);
+    Close(serverfd);
+    return;
   }
 
+  // 본문 중계 (206 등 캐싱하지 않는 응답). Content-Length가 얼마든 RELAY_WINDOW 하나로 나눠 보낸다.
+  // 헤더를 보내기 전에 예산을 잡고, 못 잡으면 503으로 답한다. 헤더가 너무 커서 이미 중계했다면
+  // 503을 보낼 수 없으므로 새 메모리 없이 헤더를 읽던 연결 버퍼(bufs->line)로 나눠 보낸다
+  if (!is_head && content_length > 0) {
+    growbuf_t window = { NULL, 0 };
+    int reserved = relay_reserve(RELAY_WINDOW) == 0;
+    long left;
+    ssize_t rc;
+
+    if (!reserved && !streamed) {
+      clienterror(clientfd, hostname, "503", "Service Unavailable", "Proxy relay memory is exhausted");
+      Close(serverfd);
+      return;
+    }
+    if (!streamed)
+      io_writen(clientfd, resp_hdrs, hdr_len);
+    if (reserved && growbuf_reserve(&window, RELAY_WINDOW) < 0) {
+      relay_release(RELAY_WINDOW);
+      reserved = 0;
+    }
+    if (!reserved)
+      window = bufs->line;
+
+    for (left = content_length; left > 0 && window.size; left -= rc) {
+      if ((rc = io_readnb(&response_rio, window.ptr, left < (long)window.size ? left : (long)window.size)) <= 0 ||
+          io_writen(clientfd, window.ptr, rc) < 0)
+        break;
+    }
+    if (reserved) {
+      growbuf_free(&window);
+      relay_release(RELAY_WINDOW);
+    }
+  } else if (!streamed) {
+    io_writen(clientfd, resp_hdrs, hdr_len);
+  }
   Close(serverfd);
+
+  // 원 서버가 부분 응답을 줬다면 전체 객체는 백그라운드에서 받아 캐시에 채운다
+  // (Vary가 있으면 백그라운드 요청에는 클라이언트 헤더가 없으므로 채우지 않는다)
+  if (RANGE_FILL_ON_MISS && status == 206 && !is_head && !varies &&
+      range_total > 0 && range_total <= MAX_OBJECT_SIZE)
+    start_range_fill(hostname, port, path, &key);
+}
+
+/*
+ * handle_local - 프록시 자신을 향한 요청 처리.
+ * /stats는 캐시 관련 카운터를 text/plain으로 돌려준다.
+ */
+void handle_local(int clientfd, char *uri)
+{
+  int size = MAXBUF * 4, len = 0;
+  char *body;
+
+  if (strcmp(uri, "/stats")) {
+    clienterror(clientfd, uri, "404", "Not found", "Proxy has no such resource");
+    return;
+  }
+  if (!(body = arena_alloc(request_arena, size))) // 연결 스레드 스택에 두기엔 크다
+    return;
+
+  len += cache_stats(body + len, size - len);
+  len += query_rule_stats(body + len, size - len);
+  len += slab_stats(body + len, size - len);
+  len += disk_stats(body + len, size - len);
+  len += snapshot_stats(body + len, size - len);
+  len += shm_cache_stats(body + len, size - len);
+  len += ban_stats(body + len, size - len);
+  len += l1_stats(body + len, size - len);
+  len += dedup_stats(body + len, size - len);
+  len += gzip_stats(body + len, size - len);
+  len += io_stats(body + len, size - len);
+  len += bufpool_stats(body + len, size - len);
+  len += arena_stats(body + len, size - len);
+  len += relay_stats(body + len, size - len);
+  len += snprintf(body + len, size - len,
+                  "fill_client_aborts %lu\n"
+                  "fill_continued %lu\n",
+                  __atomic_load_n(&fill_client_aborts, __ATOMIC_RELAXED),
+                  __atomic_load_n(&fill_continued, __ATOMIC_RELAXED));
+  send_text(clientfd, body, len);
+}
+
+/*
+ * handle_purge - 캐시 무효화 요청 처리. 같은 호스트(루프백)에서 온 요청만 받는다.
+ *   PURGE + Surrogate-Key: 헤더    그 태그가 붙은 객체를 모두 무효화
+ *   PURGE http://host/path       그 URL 하나를 모든 계층에서 바로 지운다 (쿼리 규칙 적용)
+ *   BAN http://host/prefix       키가 그 접두사로 시작하는 객체를 모두 무효화
+ * 태그와 접두사는 시각만 기록해 두고 객체는 다음 조회 때 지운다 (ban.h 참고).
+ */
+void handle_purge(int clientfd, io_rio_t *rp, conn_bufs_t *bufs, char *method, char *uri)
+{
+  char *buf, *value, *surrogate_key = "", *body, *hostname, *port, *path, *keypath;
+  size_t field = strlen(uri) + 3; // 포트가 없으면 "80"을 쓴다
+  cache_key_t key;
+  int len, n;
+
+  // 태그 목록은 길 수 있으므로 Surrogate-Key 값은 arena에 옮겨 둔다
+  while (io_readline(rp, &bufs->line, MAXLINE) > 0 && strcmp(buf = bufs->line.ptr, "\r\n")) {
+    if (strncasecmp(buf, "Surrogate-Key:", 14) == 0 &&
+        (value = arena_alloc(&bufs->arena, n = strlen(buf)))) {
+      header_value(buf + 14, value, n);
+      surrogate_key = value;
+    }
+  }
+
+  hostname = arena_alloc(&bufs->arena, field);
+  port = arena_alloc(&bufs->arena, field);
+  path = arena_alloc(&bufs->arena, field);
+  if (!(keypath = arena_alloc(&bufs->arena, field)))
+    return;
+
+  if (!is_loopback_peer(clientfd)) {
+    clienterror(clientfd, method, "403", "Forbidden", "Cache invalidation is allowed from localhost only");
+    return;
+  }
+
+  if (!strcasecmp(method, "PURGE") && surrogate_key[0]) {
+    n = ban_tags(surrogate_key);
+    if (!(body = arena_alloc(&bufs->arena, 32)))
+      return;
+    len = sprintf(body, "banned tags %d\n", n);
+  } else if (uri[0] == '/') {
+    clienterror(clientfd, uri, "400", "Bad Request", "Invalidation needs an absolute URL or Surrogate-Key");
+    return;
+  } else if (!strcasecmp(method, "BAN")) {
+    parse_uri(uri, hostname, port, path);
+    build_cache_key(&key, hostname, port, path);
+    ban_prefix(key.str, key.len);
+    if (!(body = arena_alloc(&bufs->arena, key.len + 32)))
+      return;
+    len = sprintf(body, "banned prefix %s\n", key.str);
+  } else {
+    parse_uri(uri, hostname, port, path);
+    normalize_query(hostname, port, path, keypath);
+    build_cache_key(&key, hostname, port, keypath);
+    n = purge_cache(&key);
+    n |= disk_invalidate(key.hash, key.str, key.len, ban_now());
+    n |= snapshot_invalidate(key.hash, key.str, key.len);
+    n |= shm_cache_purge(&key);
+    if (!n) {
+      clienterror(clientfd, key.str, "404", "Not found", "Object is not cached");
+      return;
+    }
+    if (!(body = arena_alloc(&bufs->arena, key.len + 32)))
+      return;
+    len = sprintf(body, "purged %s\n", key.str);
+  }
+  send_text(clientfd, body, len);
+}
+
+/* is_loopback_peer - 연결 상대가 127.0.0.0/8 또는 ::1(IPv4 매핑 포함)이면 1 */
+int is_loopback_peer(int fd)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof(addr);
+
+  if (getpeername(fd, (SA *)&addr, &addrlen) < 0)
+    return 0;
+  if (addr.ss_family == AF_INET)
+    return (ntohl(((struct sockaddr_in *)&addr)->sin_addr.s_addr) >> 24) == 127;
+  if (addr.ss_family == AF_INET6) {
+    struct in6_addr *a = &((struct sockaddr_in6 *)&addr)->sin6_addr;
+    return IN6_IS_ADDR_LOOPBACK(a) || (IN6_IS_ADDR_V4MAPPED(a) && a->s6_addr[12] == 127);
+  }
+  return 0;
+}
+
+/* header_value - 헤더 값(앞 공백과 줄 끝을 뺀)을 size 바이트 버퍼 value에 복사한다. 넘치면 잘라 넣고 -1 */
+int header_value(char *p, char *value, int size)
+{
+  int len;
+
+  p += strspn(p, " \t");
+  len = strcspn(p, "\r\n");
+  snprintf(value, size, "%.*s", len, p);
+  return len < size ? 0 : -1;
+}
+
+/* send_text - 200 text/plain 응답 */
+void send_text(int clientfd, char *body, int len)
+{
+  char buf[MAXLINE];
+
+  sprintf(buf, "HTTP/1.0 200 OK\r\n"
+               "Server: Tiny Web Server\r\n"
+               "Connection: close\r\n"
+               "Content-type: text/plain\r\n"
+               "Content-length: %d\r\n\r\n", len);
+  io_writen(clientfd, buf, strlen(buf));
+  io_writen(clientfd, body, len);
 }
 
 void parse_uri(char *uri, char *hostname, char *port, char *path) {
@@ -189,149 +798,605 @@ void parse_uri(char *uri, char *hostname, char *port, char *path) {
     }
 }
 
-void read_requesthdrs(rio_t *rp, int serverfd, char *hostname){
-  char buf[MAXLINE];
-  int has_host = 0;
-  
-  while(Rio_readlineb(rp, buf, MAXLINE) > 0){
+/*
+ * read_requesthdrs - 클라이언트 요청 헤더를 읽어 hdrs에 모아 둔다.
+ * Host/Connection/User-Agent 등은 send_requesthdrs가 다시 붙이므로 빼고,
+ * Range 값은 range에 따로 저장한다. If-Range가 있으면 검증할 수 없으므로 Range를 무시한다.
+ * Accept-Encoding은 원 서버에 보내지 않고(캐시에는 압축하지 않은 본문만 받는다) gzip을 받는지만
+ * gzip_ok에 남긴다. 줄은 line에 읽고 hdrs는 필요한 만큼 키운다. 헤더가 MAXBUF를 넘으면 -1을 반환.
+ */
+int read_requesthdrs(io_rio_t *rp, growbuf_t *line, growbuf_t *hdrs, char *range, int *gzip_ok){
+  char *buf;
+  size_t len = 0;
+  ssize_t n;
+  int ignore_range = 0;
+
+  if(growbuf_reserve(hdrs, 1) < 0){
+    return -1;
+  }
+  hdrs->ptr[0] = '\0';
+  range[0] = '\0';
+  *gzip_ok = 0;
+  while((n = io_readline(rp, line, MAXLINE)) > 0){
+    buf = line->ptr;
     if(strcmp(buf, "\r\n") == 0){
       break;
     }
-    if(strncasecmp(buf, "Host", 5) == 0){
-      has_host =1;
-      sprintf(buf, "Host: %s\r\n", hostname);
-    }else if (strncasecmp(buf, "User-Agent", 11) == 0){
-      strcpy(buf, user_agent_hdr);
-    }else if(strncasecmp(buf, "Connection:", 11) == 0){
-      strcpy(buf, "Connection: close\r\n");
-    }else if(strncasecmp(buf, "Proxy-Connection:", 17) == 0){
-      strcpy(buf, "Proxy-Connection: close\r\n");
+    if(strncasecmp(buf, "Host:", 5) == 0 ||
+       strncasecmp(buf, "User-Agent:", 11) == 0 ||
+       strncasecmp(buf, "Connection:", 11) == 0 ||
+       strncasecmp(buf, "Proxy-Connection:", 17) == 0){
+      continue;
+    }
+    if(strncasecmp(buf, "Accept-Encoding:", 16) == 0){
+      *gzip_ok = gzip_accepted(buf + 16);
+      continue;
+    }
+    if(strncasecmp(buf, "Range:", 6) == 0){
+      if(header_value(buf + 6, range, RANGE_HDR_MAX) < 0){
+        ignore_range = 1; // 구간이 이렇게 많으면 어차피 MAX_RANGES를 넘는다
+      }
+    }else if(strncasecmp(buf, "If-Range:", 9) == 0){
+      ignore_range = 1;
     }
-    Rio_writen(serverfd, buf, strlen(buf));
+    if(len + n >= MAXBUF || growbuf_reserve(hdrs, len + n + 1) < 0){
+      return -1;
+    }
+    memcpy(hdrs->ptr + len, buf, n + 1);
+    len += n;
   }
 
-  if(!has_host){
-    sprintf(buf, "Host: %s\r\n", hostname);
-    Rio_writen(serverfd, buf, strlen(buf));
+  if(ignore_range){
+    range[0] = '\0';
   }
-  sprintf(buf, "Connection: close\r\n");
-  Rio_writen(serverfd, buf, strlen(buf));
+  return 0;
+}
 
-  sprintf(buf, "Proxy-Connection: close\r\n");
-  Rio_writen(serverfd, buf, strlen(buf));
+/* send_requesthdrs - 요청 헤더 뒤에 프록시가 정한 헤더를 붙여 보낸다. 원 서버가 끊었으면 -1 */
+int send_requesthdrs(int serverfd, char *hdrs, char *hostname){
+  char buf[MAXLINE];
 
-  sprintf(buf, "%s", user_agent_hdr);
-  Rio_writen(serverfd, buf, strlen(buf));
+  if(io_writen(serverfd, hdrs, strlen(hdrs)) < 0)
+    return -1;
 
-  sprintf(buf, "\r\n");
-  Rio_writen(serverfd, buf, strlen(buf));
+  sprintf(buf, "Host: %s\r\n"
+               "Connection: close\r\n"
+               "Proxy-Connection: close\r\n"
+               "%s"
+               "\r\n", hostname, user_agent_hdr);
+  return io_writen(serverfd, buf, strlen(buf));
 }
 
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) {
-    char buf[MAXLINE], body[MAXBUF];
-
-    // HTTP response body 만들기
-    sprintf(body, "<html><title>Proxy Error</title>");
-    sprintf(body + strlen(body),
-            "<body bgcolor=\"ffffff\">\r\n");
-    sprintf(body + strlen(body),
-            "%s: %s\r\n", errnum, shortmsg);
-    sprintf(body + strlen(body),
-            "<p>%s: %s\r\n", longmsg, cause);
-    sprintf(body + strlen(body),
-            "<hr><em>My Proxy Server</em>\r\n</body></html>");
-
-    // HTTP response 헤더
-    sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
-
-    sprintf(buf, "Content-type: text/html\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-
-    sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-    Rio_writen(fd, buf, strlen(buf));
-
-    // body 전송
-    Rio_writen(fd, body, strlen(body));
+    char *buf = arena_alloc(request_arena, strlen(cause) + MAXLINE);
+
+    if (buf)
+        io_writen(fd, buf, build_error(buf, cause, errnum, shortmsg, longmsg));
+}
+
+/* header_length - 응답 resp[0, len)에서 헤더 끝의 빈 줄까지의 길이 (빈 줄이 없으면 len) */
+int header_length(char *resp, int len)
+{
+  int i;
+
+  for (i = 3; i < len; i++)
+    if (resp[i] == '\n' && resp[i - 1] == '\r' && resp[i - 2] == '\n' && resp[i - 3] == '\r')
+      return i + 1;
+  return len;
+}
+
+#define ERROR_BODY "<html><title>Proxy Error</title>" \
+                   "<body bgcolor=\"ffffff\">\r\n" \
+                   "%s: %s\r\n" \
+                   "<p>%s: %s\r\n" \
+                   "<hr><em>My Proxy Server</em>\r\n</body></html>"
+
+/*
+ * build_error - 오류 응답 전체(상태 줄, 헤더, 본문)를 buf에 만들고 길이를 반환.
+ * buf는 cause 길이에 MAXLINE을 더한 크기면 충분하다.
+ */
+int build_error(char *buf, char *cause, char *errnum, char *shortmsg, char *longmsg) {
+    // 본문 길이를 먼저 재고 헤더 바로 뒤에 본문을 쓴다 (본문을 따로 담을 버퍼가 필요 없다)
+    int body_len = snprintf(NULL, 0, ERROR_BODY, errnum, shortmsg, longmsg, cause);
+    int len = sprintf(buf, "HTTP/1.0 %s %s\r\n"
+                           "Content-type: text/html\r\n"
+                           "Content-length: %d\r\n\r\n", errnum, shortmsg, body_len);
+
+    return len + sprintf(buf + len, ERROR_BODY, errnum, shortmsg, longmsg, cause);
+}
+
+/*
+ * set_negative_ttls - "404=10,5xx=5,connect=5,dns=30" 형식의 TTL 설정을 적용한다.
+ * 적지 않은 항목은 그대로 둔다. 오류 응답(4xx, 5xx)만 받으며 형식이 틀리면 -1
+ */
+int set_negative_ttls(char *spec)
+{
+  char buf[MAXLINE], *item, *save, *eq;
+  int ttl, status;
+
+  snprintf(buf, MAXLINE, "%s", spec);
+  for (item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+    if (!(eq = strchr(item, '=')) || (ttl = atoi(eq + 1)) < 0)
+      return -1;
+    *eq = '\0';
+    if (!strcmp(item, "connect"))
+      connect_fail_ttl = ttl;
+    else if (!strcmp(item, "dns"))
+      dns_fail_ttl = ttl;
+    else if (strlen(item) == 3 && (item[0] == '4' || item[0] == '5') && !strcmp(item + 1, "xx"))
+      for (status = (item[0] - '0') * 100; status < (item[0] - '0' + 1) * 100; status++)
+        negative_ttls[status] = ttl;
+    else if ((status = atoi(item)) >= 400 && status < 600)
+      negative_ttls[status] = ttl;
+    else
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * alloc_negative - ttl초 뒤에 만료되는 네거티브 항목을 만든다. 본문에는 호출자가
+ * 상태 줄부터 응답 전체를 채운다. TTL이 0이거나 너무 크면 NULL.
+ * length만큼 중계 예산을 잡으므로 호출자가 다 쓴 뒤 relay_release로 돌려준다. 오류 페이지를
+ * 캐싱하려고 연결 스레드를 묶어 둘 일은 아니므로 예산이 모자라면 기다리지 않고 NULL
+ */
+web_object_t *alloc_negative(cache_key_t *key, int status, int ttl, char *content_type, int length)
+{
+  web_object_t *web_object;
+
+  if (ttl <= 0 || length > MAX_OBJECT_SIZE || relay_try_reserve(length) < 0)
+    return NULL;
+  if (!(web_object = alloc_web_object(key, content_type, length))) {
+    relay_release(length);
+    return NULL;
+  }
+  web_object->status = status;
+  web_object->expires = time(NULL) + ttl;
+  return web_object;
 }
 
-web_object_t *find_cache(char *path)
-    {
-      if (!rootp) // 캐시가 비었으면
-        return NULL;
-      web_object_t *current = rootp;      // 검사를 시작할 노드
-      while (strcmp(current->path, path)) // 현재 검사 중인 노드의 path가 찾는 path와 다르면 반복
-      {
-        if (!current->next) // 현재 검사 중인 노드의 다음 노드가 없으면 NULL 반환
-          return NULL;
-
-        current = current->next;          // 다음 노드로 이동
-        if (!strcmp(current->path, path)) // path가 같은 노드를 찾았다면 해당 객체 반환
-          return current;
+/*
+ * parse_range - "bytes=a-b, c-, -n" 형태의 Range 값을 length 기준 구간들로 변환.
+ * 반환값: 만족 가능한 구간 수, 무시해야 하면 0(문법 오류, 구간 과다), 만족 불가면 -1
+ */
+int parse_range(char *range, long length, byte_range_t *ranges)
+{
+  char *p = range;
+  int n = 0, syntactic = 0;
+
+  if (strncasecmp(p, "bytes=", 6))
+    return 0;
+  p += 6;
+
+  while (*p) {
+    long start = -1, end = -1;
+    char *endp;
+
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+    if (!*p)
+      break;
+
+    if (*p == '-') { // 접미 구간: 마지막 n 바이트
+      long suffix = strtol(p + 1, &endp, 10);
+      if (endp == p + 1 || suffix < 0)
+        return 0;
+      p = endp;
+      if (suffix == 0)
+        start = length; // 만족 불가
+      else {
+        start = suffix >= length ? 0 : length - suffix;
+        end = length - 1;
+      }
+    } else {
+      start = strtol(p, &endp, 10);
+      if (endp == p || *endp != '-' || start < 0)
+        return 0;
+      p = endp + 1;
+      if (*p >= '0' && *p <= '9') {
+        end = strtol(p, &endp, 10);
+        if (end < start)
+          return 0;
+        p = endp;
       }
-      return current;
+      if (end < 0 || end >= length)
+        end = length - 1;
     }
-void send_cache(web_object_t *web_object, int clientfd)
-    {
-      // Response Header 생성 및 전송
-      char buf[MAXLINE];
-      sprintf(buf, "HTTP/1.0 200 OK\r\n");                                           // 상태 코드
-      sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);                            // 서버 이름
-      sprintf(buf, "%sConnection: close\r\n", buf);                                  // 연결 방식
-      sprintf(buf, "%sContent-length: %d\r\n\r\n", buf, web_object->content_length); // 컨텐츠 길이
-      Rio_writen(clientfd, buf, strlen(buf));
 
-      // 캐싱된 Response Body 전송
-      Rio_writen(clientfd, web_object->response_ptr, web_object->content_length);
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (*p && *p != ',')
+      return 0;
+    if (++syntactic > MAX_RANGES)
+      return 0;
+
+    if (start < length) { // 만족 가능한 구간만 남김
+      ranges[n].start = start;
+      ranges[n].end = end;
+      n++;
     }
+  }
 
- void read_cache(web_object_t *web_object)
-    {
-      if (web_object == rootp) // 현재 노드가 이미 root면 변경 없이 종료
-        return;
+  if (!syntactic)
+    return 0;
+  return n ? n : -1;
+}
 
-      // 현재 노드와 이전 & 다음 노드의 연결 끊기
-      if (web_object->next) // '이전 & 다음 노드'가 모두 있는 경우
-      {
-        // 이전 노드와 다음 노드를 이어줌
-        web_object_t *prev_objtect = web_object->prev;
-        web_object_t *next_objtect = web_object->next;
-        if (prev_objtect)
-          web_object->prev->next = next_objtect;
-        web_object->next->prev = prev_objtect;
-      }
-      else // '다음 노드'가 없는 경우 (현재 노드가 마지막 노드인 경우)
-      {
-        web_object->prev->next = NULL; // 이전 노드와 현재 노드의 연결을 끊어줌
-      }
+/*
+ * send_body - 본문의 [start, start + len) 구간을 전송. 메모리 본문은 버퍼에서 바로 쓰고,
+ * 파일 본문은 sendfile로 커널 안에서 바로 보낸다. 클라이언트가 끊었으면 -1
+ */
+int send_body(int clientfd, body_src_t *body, long start, long len)
+{
+  off_t offset = body->offset + start;
+  ssize_t n;
 
-      // 현재 노드를 root로 변경
-      web_object->next = rootp; // root였던 노드는 현재 노드의 다음 노드가 됨
-      rootp = web_object;
-    }
-  
-  void write_cache(web_object_t *web_object)
-    {
-      // total_cache_size에 현재 객체의 크기 추가
-      total_cache_size += web_object->content_length;
-
-      // 최대 총 캐시 크기를 초과한 경우 -> 사용한지 가장 오래된 객체부터 제거
-      while (total_cache_size > MAX_CACHE_SIZE)
-      {
-        total_cache_size -= lastp->content_length;
-        lastp = lastp->prev; // 마지막 노드를 마지막의 이전 노드로 변경
-        free(lastp->next);   // 제거한 노드의 메모리 반환
-        lastp->next = NULL;
-      }
+  if (body->mem)
+    return io_writen(clientfd, body->mem + start, len);
+  while (len > 0) {
+    if ((n = sendfile(clientfd, body->fd, &offset, len)) <= 0) {
+      if (n < 0 && errno == EINTR)
+        continue;
+      return -1; // 클라이언트가 끊었거나 파일 오류
+    }
+    len -= n;
+  }
+  return 0;
+}
 
-      if (!rootp) // 캐시 연결리스트가 빈 경우 lastp를 현재 객체로 지정
-        lastp = web_object;
+/*
+ * send_object - 전체 본문을 클라이언트에게 전송.
+ * Range가 있으면 단일 구간은 206, 여러 구간은 multipart/byteranges로 응답하고,
+ * 본문은 복사하지 않고 원본 버퍼(또는 파일)의 오프셋에서 바로 쓴다.
+ * extra_hdrs(NULL 가능)는 200/206 응답 헤더에 그대로 덧붙인다. body가 NULL이면(HEAD) 헤더만 보낸다.
+ */
+void send_object(int clientfd, body_src_t *body, int length, char *content_type, char *range,
+                 char *extra_hdrs)
+{
+  static unsigned long boundary_seq = 0;
+  byte_range_t ranges[MAX_RANGES];
+  char buf[MAXLINE], boundary[64];
+  int n = range && range[0] ? parse_range(range, length, ranges) : 0;
+  int i;
 
-      // 현재 객체를 루트로 지정
-      if (rootp)
-      {
-        web_object->next = rootp;
-        rootp->prev = web_object;
-      }
-      rootp = web_object;
-    }
\ No newline at end of file
+  if (n < 0) { // 만족 불가능한 구간
+    sprintf(buf, "HTTP/1.0 416 Range Not Satisfiable\r\n"
+                 "Server: Tiny Web Server\r\n"
+                 "Connection: close\r\n"
+                 "Content-range: bytes */%d\r\n"
+                 "Content-length: 0\r\n\r\n", length);
+    io_writen(clientfd, buf, strlen(buf));
+    return;
+  }
+
+  if (n == 0) { // 전체 전송
+    sprintf(buf, "HTTP/1.0 200 OK\r\n"
+                 "Server: Tiny Web Server\r\n"
+                 "Connection: close\r\n"
+                 "Accept-Ranges: bytes\r\n");
+    if (content_type && content_type[0])
+      sprintf(buf + strlen(buf), "Content-type: %s\r\n", content_type);
+    if (extra_hdrs)
+      strcat(buf, extra_hdrs);
+    sprintf(buf + strlen(buf), "Content-length: %d\r\n\r\n", length);
+    if (io_writen(clientfd, buf, strlen(buf)) == 0 && body)
+      send_body(clientfd, body, 0, length);
+    return;
+  }
+
+  if (n == 1) { // 단일 구간
+    long part_len = ranges[0].end - ranges[0].start + 1;
+    sprintf(buf, "HTTP/1.0 206 Partial Content\r\n"
+                 "Server: Tiny Web Server\r\n"
+                 "Connection: close\r\n"
+                 "Accept-Ranges: bytes\r\n");
+    if (content_type && content_type[0])
+      sprintf(buf + strlen(buf), "Content-type: %s\r\n", content_type);
+    if (extra_hdrs)
+      strcat(buf, extra_hdrs);
+    sprintf(buf + strlen(buf), "Content-range: bytes %ld-%ld/%d\r\n"
+                               "Content-length: %ld\r\n\r\n",
+            ranges[0].start, ranges[0].end, length, part_len);
+    if (io_writen(clientfd, buf, strlen(buf)) == 0 && body)
+      send_body(clientfd, body, ranges[0].start, part_len);
+    return;
+  }
+
+  // 여러 구간: 먼저 전체 길이를 계산한 뒤 파트 헤더와 본문 조각을 차례로 전송
+  sprintf(boundary, "PROXY_BYTERANGES_%08lx%08lx",
+          (unsigned long)time(NULL), __sync_add_and_fetch(&boundary_seq, 1));
+
+  long total = 0;
+  for (i = 0; i < n; i++) {
+    sprintf(buf, "\r\n--%s\r\n", boundary);
+    if (content_type && content_type[0])
+      sprintf(buf + strlen(buf), "Content-type: %s\r\n", content_type);
+    sprintf(buf + strlen(buf), "Content-range: bytes %ld-%ld/%d\r\n\r\n",
+            ranges[i].start, ranges[i].end, length);
+    total += strlen(buf) + (ranges[i].end - ranges[i].start + 1);
+  }
+  sprintf(buf, "\r\n--%s--\r\n", boundary);
+  total += strlen(buf);
+
+  sprintf(buf, "HTTP/1.0 206 Partial Content\r\n"
+               "Server: Tiny Web Server\r\n"
+               "Connection: close\r\n"
+               "Accept-Ranges: bytes\r\n"
+               "Content-type: multipart/byteranges; boundary=%s\r\n"
+               "%s"
+               "Content-length: %ld\r\n\r\n", boundary, extra_hdrs ? extra_hdrs : "", total);
+  if (io_writen(clientfd, buf, strlen(buf)) < 0 || !body)
+    return;
+
+  for (i = 0; i < n; i++) {
+    sprintf(buf, "\r\n--%s\r\n", boundary);
+    if (content_type && content_type[0])
+      sprintf(buf + strlen(buf), "Content-type: %s\r\n", content_type);
+    sprintf(buf + strlen(buf), "Content-range: bytes %ld-%ld/%d\r\n\r\n",
+            ranges[i].start, ranges[i].end, length);
+    if (io_writen(clientfd, buf, strlen(buf)) < 0 ||
+        send_body(clientfd, body, ranges[i].start, ranges[i].end - ranges[i].start + 1) < 0)
+      return; // 클라이언트가 끊었다
+  }
+  sprintf(buf, "\r\n--%s--\r\n", boundary);
+  io_writen(clientfd, buf, strlen(buf));
+}
+
+/*
+ * start_range_fill - 같은 캐시 키에 대한 채우기가 진행 중이 아니면
+ * 전체 객체를 받아 오는 백그라운드 스레드를 띄운다.
+ */
+/* 진행 중인 채우기 목록에서 fill을 빼고 해제한다 */
+static void finish_range_fill(range_fill_t *fill)
+{
+  range_fill_t **pp;
+
+  pthread_mutex_lock(&range_fill_lock);
+  for (pp = &range_fills; *pp; pp = &(*pp)->next) {
+    if (*pp == fill) {
+      *pp = fill->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&range_fill_lock);
+  free(fill);
+}
+
+void start_range_fill(char *hostname, char *port, char *path, cache_key_t *key)
+{
+  range_fill_t *fill;
+  pthread_t tid;
+
+  pthread_mutex_lock(&range_fill_lock);
+  for (fill = range_fills; fill; fill = fill->next) {
+    if (fill->key.hash == key->hash && !strcmp(fill->key.str, key->str)) {
+      pthread_mutex_unlock(&range_fill_lock);
+      return;
+    }
+  }
+  fill = calloc(1, sizeof(range_fill_t));
+  if (!fill) {
+    pthread_mutex_unlock(&range_fill_lock);
+    return;
+  }
+  strcpy(fill->hostname, hostname);
+  strcpy(fill->port, port);
+  strcpy(fill->path, path);
+  fill->key = *key;
+  fill->next = range_fills;
+  range_fills = fill;
+  pthread_mutex_unlock(&range_fill_lock);
+
+  // 스레드를 못 만들어도 클라이언트 응답은 이미 끝났으니 채우기만 건너뛴다
+  if (pthread_create(&tid, NULL, range_fill_thread, fill) != 0)
+    finish_range_fill(fill);
+}
+
+/*
+ * range_fill_thread - Range 없이 전체 객체를 받아 캐시에 넣는다.
+ * 원 서버 I/O는 io 계층(io_writen, io_readinitb/io_readlineb/io_readnb)으로 하므로 연결이
+ * 끊기거나 쓰기가 실패해도 오류만 돌려받고 채우기를 그만둔다.
+ */
+void *range_fill_thread(void *vargp)
+{
+  range_fill_t *fill = vargp;
+  char buf[MAXLINE], rio_buf[RIO_BUFSIZE], content_type[128] = "", surrogate_key[MAXLINE] = "";
+  char vary_names[VARY_NAMES_MAX] = "";
+  uint32_t tags[BAN_MAX_TAGS];
+  int serverfd, status = 0, content_length = -1, ntags, varies = 0, len;
+  io_rio_t rio;
+  ssize_t n;
+
+  Pthread_detach(pthread_self());
+
+  // 요청이 buf에 다 들어가지 않으면(긴 경로) 채우기를 건너뛴다
+  len = snprintf(buf, sizeof(buf),
+                 "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\nProxy-Connection: close\r\n%s\r\n",
+                 fill->path, fill->hostname, user_agent_hdr);
+  if (len < (int)sizeof(buf) && (serverfd = open_clientfd(fill->hostname, fill->port)) >= 0) {
+    if (io_writen(serverfd, buf, len) < 0)
+      status = -1; // 응답을 읽지 않는다
+
+    io_readinitb(&rio, serverfd, rio_buf, sizeof(rio_buf));
+    while (status >= 0 && (n = io_readlineb(&rio, buf, MAXLINE)) > 0) {
+      if (!status)
+        sscanf(buf, "HTTP/%*s %d", &status);
+      if (strncasecmp(buf, "Content-length:", 15) == 0)
+        content_length = atoi(buf + 15);
+      else if (strncasecmp(buf, "Content-type:", 13) == 0)
+        sscanf(buf + 13, " %127[^\r\n]", content_type);
+      else if (strncasecmp(buf, "Surrogate-Key:", 14) == 0)
+        sscanf(buf + 14, " %[^\r\n]", surrogate_key);
+      else if (strncasecmp(buf, "Vary:", 5) == 0)
+        varies |= parse_vary(buf + 5, vary_names) < 0 || vary_names[0];
+      if (strcmp(buf, "\r\n") == 0)
+        break;
+    }
+
+    cache_fill_t cache_fill;
+    char *body = NULL;
+    ntags = ban_intern_tags(surrogate_key, tags);
+    // 클라이언트 헤더 없이 받은 응답이므로 Vary가 있으면 어느 변형인지 알 수 없다
+    if (status == 200 && ntags >= 0 && !varies && content_length > 0 &&
+        content_length <= MAX_OBJECT_SIZE)
+      body = begin_fill(&cache_fill, &fill->key, NULL, NULL, content_type, content_length, tags,
+                        ntags);
+    if (body) {
+      if (io_readnb(&rio, body, content_length) == content_length)
+        commit_fill(&cache_fill);
+      else
+        abort_fill(&cache_fill);
+    }
+    close(serverfd);
+  }
+
+  finish_range_fill(fill);
+  return NULL;
+}
+
+/*
+ * begin_fill - 본문 length 바이트를 받을 캐시 객체를 만들고 본문 버퍼를 돌려준다.
+ * 공간이 없으면 NULL. 다 받으면 commit_fill, 중간에 실패하면 abort_fill.
+ * 태그 id는 프로세스마다 다르므로 태그가 붙은 객체는 공유 메모리 대신 이 프로세스의 캐시에 둔다.
+ * Vary 응답(primary와 vary가 있고 key는 변형 키)도 색인과 함께 빠지도록 이 프로세스의 캐시에 둔다.
+ * 본문을 다 받을 때까지 length 바이트를 중계 예산에서 잡아 둔다 (모자라면 생길 때까지 기다린다).
+ */
+char *begin_fill(cache_fill_t *fill, cache_key_t *key, cache_key_t *primary, char *vary,
+                 char *content_type, int length, uint32_t *tags, int ntags)
+{
+  char *body = NULL;
+
+  fill->web_object = NULL;
+  fill->key = key;
+  fill->primary = primary;
+  fill->vary = vary;
+  fill->reserved = length;
+  if (relay_reserve(length) < 0)
+    return NULL;
+  if (shm_cache_enabled() && !ntags && !primary)
+    body = shm_cache_alloc(key, content_type, length, &fill->shm) ? fill->shm.body : NULL;
+  else if ((fill->web_object = alloc_tagged_object(key, content_type, length, tags, ntags)))
+    body = fill->web_object->response_ptr;
+  if (!body)
+    relay_release(length);
+  return body;
+}
+
+void commit_fill(cache_fill_t *fill)
+{
+  int compress;
+
+  if (fill->web_object) {
+    compress = gzip_wanted(fill->web_object); // write_cache가 돌려준 뒤에는 객체를 볼 수 없다
+    if ((fill->primary ? cache_write_variant(fill->primary, fill->vary, fill->web_object)
+                       : write_cache(fill->web_object)) && compress)
+      gzip_offer(fill->key);
+  } else
+    shm_cache_publish(&fill->shm);
+  relay_release(fill->reserved);
+}
+
+void abort_fill(cache_fill_t *fill)
+{
+  if (fill->web_object)
+    free_web_object(fill->web_object);
+  else
+    shm_cache_abort(&fill->shm);
+  relay_release(fill->reserved);
+}
+
+/*
+ * use_variant - Vary 색인 index의 목록과 요청 헤더로 변형 키를 *variant에 만들어 돌려주고,
+ * 변형을 보낼 때 붙일 Vary 헤더를 vary_hdr에 쓴다. 변형 키는 처음 한 번 arena에 받는다.
+ * 메모리가 없으면 NULL
+ */
+cache_key_t *use_variant(web_object_t *index, cache_key_t *key, char *hdrs, cache_key_t **variant,
+                         char *vary_hdr)
+{
+  char *names = OBJECT_VARY_INDEX(index)->names;
+
+  if (!*variant && !(*variant = arena_alloc(request_arena, sizeof(cache_key_t))))
+    return NULL;
+  build_variant_key(*variant, key, names, hdrs);
+  sprintf(vary_hdr, "Vary: %s\r\n", names);
+  return *variant;
+}
+
+/*
+ * send_cache - 캐시 객체를 전송. gzip 객체는 send_gzip으로 보내고, 나중에 gzip으로 바뀔 수
+ * 있는 텍스트 객체에는 Vary: Accept-Encoding을 붙인다. vary_hdr는 변형이면 원 서버의 Vary
+ * 목록, 아니면 빈 문자열이다. head면 본문 없이 GET과 같은 헤더만 보낸다.
+ */
+void send_cache(web_object_t *web_object, int clientfd, char *range, int gzip_ok, char *vary_hdr,
+                int head)
+{
+  char extra_hdrs[VARY_NAMES_MAX + 64], *ae = gzip_vary(OBJECT_TYPE(web_object));
+
+  // 네거티브 항목은 저장해 둔 응답을 그대로 전송
+  if (web_object->status != 200) {
+    io_writen(clientfd, web_object->response_ptr,
+               head ? header_length(web_object->response_ptr, web_object->content_length)
+                    : web_object->content_length);
+    return;
+  }
+
+  sprintf(extra_hdrs, "%s%s", vary_hdr, ae ? ae : "");
+  if (web_object->encoding == OBJECT_GZIP) {
+    send_gzip(web_object, clientfd, range, gzip_ok, extra_hdrs, head);
+    return;
+  }
+
+  // Range가 있으면 캐시된 본문에서 필요한 구간만 잘라서 전송
+  body_src_t body = { web_object->response_ptr, -1, 0 };
+
+  send_object(clientfd, head ? NULL : &body, web_object->content_length, OBJECT_TYPE(web_object),
+              range, extra_hdrs);
+}
+
+/*
+ * send_gzip - gzip 객체 전송. gzip을 받는 클라이언트의 전체 요청에는 압축된 본문을 그대로,
+ * 그 밖에는 압축을 풀면서 보낸다. Range 구간은 압축을 푼 본문 기준이다.
+ * extra_hdrs에는 Vary: Accept-Encoding이 들어 있다. head면 압축을 풀지 않고 헤더만 보낸다.
+ */
+void send_gzip(web_object_t *web_object, int clientfd, char *range, int gzip_ok, char *extra_hdrs,
+               int head)
+{
+  char buf[MAXLINE], *plain;
+
+  if (range[0] && head) {
+    send_object(clientfd, NULL, web_object->identity_length, OBJECT_TYPE(web_object), range,
+                extra_hdrs);
+    return;
+  }
+  if (range[0]) {
+    if (!(plain = arena_alloc(request_arena, web_object->identity_length)) ||
+        gzip_inflate(web_object->response_ptr, web_object->content_length, plain,
+                     web_object->identity_length) < 0) {
+      clienterror(clientfd, web_object->key, "500", "Internal Server Error", "Corrupt cached object");
+      return;
+    }
+    body_src_t body = { plain, -1, 0 };
+    send_object(clientfd, &body, web_object->identity_length, OBJECT_TYPE(web_object), range,
+                extra_hdrs);
+    return;
+  }
+
+  sprintf(buf, "HTTP/1.0 200 OK\r\n"
+               "Server: Tiny Web Server\r\n"
+               "Connection: close\r\n"
+               "Accept-Ranges: bytes\r\n"
+               "Content-type: %s\r\n"
+               "%s%s"
+               "Content-length: %d\r\n\r\n",
+          OBJECT_TYPE(web_object), gzip_ok ? "Content-Encoding: gzip\r\n" : "", extra_hdrs,
+          gzip_ok ? web_object->content_length : web_object->identity_length);
+  io_writen(clientfd, buf, strlen(buf));
+  if (head)
+    return;
+  if (gzip_ok) {
+    io_writen(clientfd, web_object->response_ptr, web_object->content_length);
+    gzip_count_sent(web_object);
+  } else {
+    gzip_send(clientfd, web_object->response_ptr, web_object->content_length);
+  }
+}
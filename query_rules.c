@@ -0,0 +1,214 @@
+/*
+ * query_rules.c - 시작할 때 규칙 파일을 읽어 접두사 트라이로 컴파일하고,
+ * 요청마다 트라이를 한 번 내려가며 가장 긴 접두사 규칙을 찾아 쿼리를 정규화한다.
+ */
+#include "csapp.h"
+#include "query_rules.h"
+
+#define MAX_STRIP 32   // 규칙 하나당 제거할 파라미터 이름 수
+#define MAX_PARAMS 128 // 정렬할 수 있는 쿼리 파라미터 수
+
+struct query_rule_t
+{
+  char prefix[MAXLINE];   // 규칙 파일에 적힌 그대로의 접두사 (통계 출력용)
+  char *strip[MAX_STRIP]; // 제거할 파라미터 이름, 끝이 *면 접두사 일치
+  int nstrip;
+  int sort;
+  int ignore;
+  unsigned long lookups, hits;
+  struct query_rule_t *next; // 통계 출력용 전체 규칙 목록
+};
+
+/* 첫 자식 / 다음 형제로 연결한 바이트 트라이 */
+typedef struct trie_node_t
+{
+  char c;
+  query_rule_t *rule; // 이 노드에서 끝나는 접두사의 규칙
+  struct trie_node_t *child, *sibling;
+} trie_node_t;
+
+static trie_node_t host_root;     // "host[:port]/path" 접두사
+static trie_node_t any_host_root; // "*/path" 규칙의 경로 접두사
+static query_rule_t *rules = NULL;
+
+static void trie_insert(trie_node_t *node, char *s, query_rule_t *rule)
+{
+  for (; *s; s++) {
+    trie_node_t *child;
+    for (child = node->child; child && child->c != *s; child = child->sibling)
+      ;
+    if (!child) {
+      child = Calloc(1, sizeof(trie_node_t));
+      child->c = *s;
+      child->sibling = node->child;
+      node->child = child;
+    }
+    node = child;
+  }
+  node->rule = rule;
+}
+
+/* s의 가장 긴 접두사에 해당하는 규칙을 찾는다 */
+static query_rule_t *trie_match(trie_node_t *node, char *s)
+{
+  query_rule_t *best = node->rule;
+
+  for (; *s && *s != '?'; s++) {
+    for (node = node->child; node && node->c != *s; node = node->sibling)
+      ;
+    if (!node)
+      break;
+    if (node->rule)
+      best = node->rule;
+  }
+  return best;
+}
+
+/*
+ * load_query_rules - 규칙 파일을 읽어 트라이를 만든다. 파일을 열 수 없거나
+ * 알 수 없는 동작이 있으면 -1을 반환.
+ */
+int load_query_rules(char *filename)
+{
+  FILE *fp;
+  char line[MAXLINE], *tok, *save;
+  int lineno = 0;
+
+  if (!(fp = fopen(filename, "r"))) {
+    fprintf(stderr, "query rules: cannot open %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+
+  while (fgets(line, MAXLINE, fp)) {
+    query_rule_t *rule;
+    char *p;
+    int stripping = 0;
+
+    lineno++;
+    if ((p = strchr(line, '#')))
+      *p = '\0';
+    if (!(tok = strtok_r(line, " \t\r\n", &save)))
+      continue;
+
+    rule = Calloc(1, sizeof(query_rule_t));
+    strcpy(rule->prefix, tok);
+    while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+      if (!strcmp(tok, "strip"))
+        stripping = 1;
+      else if (!strcmp(tok, "sort"))
+        rule->sort = 1, stripping = 0;
+      else if (!strcmp(tok, "ignore"))
+        rule->ignore = 1, stripping = 0;
+      else if (stripping && rule->nstrip < MAX_STRIP)
+        rule->strip[rule->nstrip++] = strdup(tok);
+      else {
+        fprintf(stderr, "query rules: %s:%d: unknown action '%s'\n", filename, lineno, tok);
+        fclose(fp);
+        return -1;
+      }
+    }
+
+    // 호스트 부분은 캐시 키와 같이 소문자로 맞춘다
+    for (p = rule->prefix; *p && *p != '/'; p++)
+      *p = tolower(*p);
+    if (!strncmp(rule->prefix, "*/", 2))
+      trie_insert(&any_host_root, rule->prefix + 1, rule);
+    else
+      trie_insert(&host_root, rule->prefix, rule);
+
+    rule->next = rules;
+    rules = rule;
+  }
+  fclose(fp);
+  return 0;
+}
+
+static int param_cmp(const void *a, const void *b)
+{
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+static int strip_param(query_rule_t *rule, char *param)
+{
+  int i, len = strcspn(param, "=");
+
+  for (i = 0; i < rule->nstrip; i++) {
+    char *name = rule->strip[i];
+    int n = strlen(name);
+    if (n && name[n - 1] == '*') {
+      if (len >= n - 1 && !strncmp(param, name, n - 1))
+        return 1;
+    } else if (len == n && !strncmp(param, name, n))
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * normalize_query - 요청에 맞는 규칙을 찾아 캐시 키에 쓸 경로를 keypath에 만든다.
+ * 적용한 규칙을 반환하고, 규칙이 없으면 path를 그대로 복사하고 NULL을 반환.
+ * 원 서버로는 원래 path를 그대로 보낸다.
+ */
+query_rule_t *normalize_query(char *hostname, char *port, char *path, char *keypath)
+{
+  char subject[MAXLINE], query[MAXLINE], *params[MAX_PARAMS], *q, *p, *save;
+  query_rule_t *rule = NULL;
+  int i, n = 0;
+
+  strcpy(keypath, path);
+  if (!rules)
+    return NULL;
+
+  // 캐시 키와 같은 모양의 "host[:port]/path"로 트라이를 내려간다
+  for (p = hostname, i = 0; *p && i < MAXLINE / 2; p++)
+    subject[i++] = tolower(*p);
+  if (strcmp(port, "80") && port[0])
+    i += snprintf(subject + i, MAXLINE / 2, ":%s", port);
+  snprintf(subject + i, MAXLINE - i, "%s", path);
+
+  if (!(rule = trie_match(&host_root, subject)))
+    rule = trie_match(&any_host_root, path);
+  if (!rule || !(q = strchr(keypath, '?')))
+    return rule;
+
+  *q = '\0'; // keypath는 일단 경로까지만
+  if (rule->ignore)
+    return rule;
+
+  strcpy(query, strchr(path, '?') + 1);
+  for (p = strtok_r(query, "&", &save); p && n < MAX_PARAMS; p = strtok_r(NULL, "&", &save))
+    if (!strip_param(rule, p))
+      params[n++] = p;
+  if (rule->sort)
+    qsort(params, n, sizeof(char *), param_cmp);
+
+  for (i = 0; i < n; i++) {
+    strcat(keypath, i ? "&" : "?");
+    strcat(keypath, params[i]);
+  }
+  return rule;
+}
+
+/* count_query_rule - 규칙별 캐시 조회 수와 적중 수를 센다 */
+void count_query_rule(query_rule_t *rule, int hit)
+{
+  if (!rule)
+    return;
+  __sync_fetch_and_add(&rule->lookups, 1);
+  if (hit)
+    __sync_fetch_and_add(&rule->hits, 1);
+}
+
+/* query_rule_stats - 규칙별 적중률을 buf에 텍스트로 쓰고 길이를 반환 */
+int query_rule_stats(char *buf, int size)
+{
+  query_rule_t *rule;
+  int len = 0;
+
+  for (rule = rules; rule && len < size; rule = rule->next) {
+    unsigned long lookups = rule->lookups, hits = rule->hits;
+    len += snprintf(buf + len, size - len, "query_rule %s lookups %lu hits %lu hit_ratio %.1f%%\n",
+                    rule->prefix, lookups, hits, lookups ? 100.0 * hits / lookups : 0.0);
+  }
+  return len < size ? len : size;
+}
@@ -0,0 +1,20 @@
+/*
+ * query_rules.h - 캐시 키를 만들기 전에 쿼리 스트링을 정규화하는 규칙 테이블
+ *
+ * 규칙 파일은 한 줄에 하나씩 "<host/path 접두사> <동작>..." 형식이다.
+ *   example.com/search  strip utm_* sid sort
+ *   cdn.example.com/    ignore
+ * 동작: strip <이름>... (끝의 *는 접두사 일치), sort (남은 파라미터 정렬), ignore (쿼리 전체 무시)
+ * 호스트 자리에 *를 쓰면 모든 호스트의 경로 접두사에 적용된다. 가장 긴 접두사 규칙 하나만 적용.
+ */
+#ifndef __QUERY_RULES_H__
+#define __QUERY_RULES_H__
+
+typedef struct query_rule_t query_rule_t;
+
+int load_query_rules(char *filename);
+query_rule_t *normalize_query(char *hostname, char *port, char *path, char *keypath);
+void count_query_rule(query_rule_t *rule, int hit);
+int query_rule_stats(char *buf, int size);
+
+#endif /* __QUERY_RULES_H__ */
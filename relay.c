@@ -0,0 +1,96 @@
+/*
+ * relay.c - 중계 메모리 예산
+ */
+#include "csapp.h"
+#include "relay.h"
+
+static pthread_mutex_t relay_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t relay_cond = PTHREAD_COND_INITIALIZER;
+static size_t budget = RELAY_BUDGET, inflight, peak;
+static unsigned long reserves, waits, timeouts;
+
+/* relay_set_budget - 예산을 바꾼다. 시작할 때 한 번 부른다 */
+void relay_set_budget(size_t bytes)
+{
+  pthread_mutex_lock(&relay_lock);
+  budget = bytes;
+  pthread_mutex_unlock(&relay_lock);
+}
+
+/*
+ * relay_reserve - 예산에서 n바이트를 잡는다. 모자라면 자리가 날 때까지 기다리고,
+ * RELAY_WAIT_MS가 지나도록 나지 않으면 -1
+ */
+int relay_reserve(size_t n)
+{
+  struct timespec deadline;
+  int rc = 0;
+
+  pthread_mutex_lock(&relay_lock);
+  if (inflight && inflight + n > budget) {
+    waits++;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += RELAY_WAIT_MS / 1000;
+    deadline.tv_nsec += (RELAY_WAIT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    while (inflight && inflight + n > budget && rc != ETIMEDOUT)
+      rc = pthread_cond_timedwait(&relay_cond, &relay_lock, &deadline);
+    if (inflight && inflight + n > budget) {
+      timeouts++;
+      pthread_mutex_unlock(&relay_lock);
+      return -1;
+    }
+  }
+  inflight += n;
+  if (inflight > peak)
+    peak = inflight;
+  reserves++;
+  pthread_mutex_unlock(&relay_lock);
+  return 0;
+}
+
+/* relay_try_reserve - 기다리지 않는 relay_reserve. 지금 자리가 없으면 바로 -1 */
+int relay_try_reserve(size_t n)
+{
+  int rc = -1;
+
+  pthread_mutex_lock(&relay_lock);
+  if (!inflight || inflight + n <= budget) {
+    inflight += n;
+    if (inflight > peak)
+      peak = inflight;
+    reserves++;
+    rc = 0;
+  }
+  pthread_mutex_unlock(&relay_lock);
+  return rc;
+}
+
+/* relay_release - relay_reserve로 잡은 n바이트를 돌려주고 기다리는 중계를 깨운다 */
+void relay_release(size_t n)
+{
+  pthread_mutex_lock(&relay_lock);
+  inflight -= n;
+  pthread_mutex_unlock(&relay_lock);
+  pthread_cond_broadcast(&relay_cond);
+}
+
+int relay_stats(char *buf, int size)
+{
+  int len;
+
+  pthread_mutex_lock(&relay_lock);
+  len = snprintf(buf, size,
+                 "relay_budget_bytes %zu\n"
+                 "relay_inflight_bytes %zu\n"
+                 "relay_peak_bytes %zu\n"
+                 "relay_reserves %lu\n"
+                 "relay_waits %lu\n"
+                 "relay_wait_timeouts %lu\n",
+                 budget, inflight, peak, reserves, waits, timeouts);
+  pthread_mutex_unlock(&relay_lock);
+  return len < size ? len : size;
+}
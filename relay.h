@@ -0,0 +1,29 @@
+/*
+ * relay.h - 원 서버 응답을 받는 동안 잡는 메모리의 전역 예산
+ *
+ * 캐시에 채우는 본문과 네거티브 응답(최대 MAX_OBJECT_SIZE)은 다 받을 때까지 메모리에 있고,
+ * 캐싱하지 않는 본문은 RELAY_WINDOW 크기의 창 하나로 나눠 중계한다. 어느 쪽이든 원 서버에서
+ * 읽기 전에 그만큼 예산을 잡고 끝나면 돌려준다.
+ *
+ * 예산이 모자라면 다른 중계가 돌려줄 때까지 기다리며, 그동안 원 서버 소켓을 읽지 않으므로
+ * TCP 흐름 제어가 원 서버를 늦춘다. Content-Length가 얼마든 중계에 쓰는 메모리는 예산을
+ * 넘지 않는다 (예산보다 큰 예약 하나는 다른 예약이 없을 때 혼자 지나간다).
+ * RELAY_WAIT_MS 안에 자리가 나지 않으면 그 요청을 포기한다.
+ */
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include <stddef.h>
+#include "bufpool.h"
+
+#define RELAY_BUDGET (64 << 20)      // 기본 예산. -R로 바꾼다 (MB)
+#define RELAY_WINDOW BUFPOOL_LARGE   // 캐싱하지 않는 본문을 중계하는 창 크기
+#define RELAY_WAIT_MS 30000
+
+void relay_set_budget(size_t bytes);
+int relay_reserve(size_t n);
+int relay_try_reserve(size_t n);
+void relay_release(size_t n);
+int relay_stats(char *buf, int size);
+
+#endif /* __RELAY_H__ */
@@ -0,0 +1,590 @@
+/*
+ * shmcache.c - 오프셋 기반 공유 메모리 캐시
+ *
+ * 세그먼트 구성: shm_header_t | 해시 버킷(오프셋 배열) | 페이지들
+ * 페이지는 한 크기 클래스에 배정되어 같은 크기 청크로 잘리고, 객체 하나(엔트리 헤더, 키,
+ * Content-type, 본문)가 청크 하나를 차지한다. 공간이 없으면 같은 클래스의 LRU 끝부터 제거한다.
+ */
+#include "shmcache.h"
+#include <sys/file.h>
+
+/* 청크 상태. 락을 잡은 채 죽은 프로세스가 있으면 이것만 보고 인덱스를 다시 만든다 */
+#define SHM_FREE 0    // 빈 청크 (한 번도 쓰지 않은 청크도 0이다)
+#define SHM_LIVE 1    // 인덱스에 들어 있음
+#define SHM_EVICTED 2 // 인덱스에서 빠졌고 마지막 참조가 풀리면 해제
+#define SHM_FILLING 3 // shm_cache_alloc으로 받아 채우는 중
+
+typedef struct
+{
+  uint64_t chunk_size;
+  uint64_t free_head;       // 빈 청크 목록 (청크 앞 8바이트에 다음 오프셋)
+  uint64_t lru_head, lru_tail;
+  uint64_t pages, used;
+} shm_class_t;
+
+typedef struct
+{
+  pid_t pid;                // 0이면 빈 슬롯
+  uint32_t nheld;
+  uint64_t held[SHM_MAX_HELD]; // 이 프로세스가 잡고 있는 엔트리 오프셋
+} shm_proc_t;
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  volatile uint32_t ready; // 초기화를 마친 뒤에 1
+  uint64_t size;
+  pthread_mutex_t lock;    // PTHREAD_PROCESS_SHARED + PTHREAD_MUTEX_ROBUST
+  uint64_t buckets_off;
+  uint64_t page_class_off; // 페이지마다 배정된 클래스 (uint8_t 배열)
+  uint64_t first_page;
+  uint64_t next_page;      // 아직 어느 클래스에도 배정하지 않은 첫 페이지
+  uint32_t nclasses;
+  shm_class_t classes[SHM_MAX_CLASSES];
+  shm_proc_t procs[SHM_MAX_PROCS];
+  uint64_t objects, bytes;
+  uint64_t hits, misses, inserts, evictions, reaped, recoveries, rebuilds, banned, purged;
+} shm_header_t;
+
+typedef struct
+{
+  uint64_t hnext, prev, next; // 해시 체인, 클래스 LRU (0이면 없음)
+  uint64_t hash;
+  uint64_t cached_at; // 밴 검사용. 벽시계 시각이므로 프로세스 사이에도 비교할 수 있다
+  uint32_t length;
+  uint32_t refcnt;
+  uint16_t key_len;
+  uint8_t type_len;
+  uint8_t flags;
+  uint8_t cls;
+  char key[]; // key '\0' content_type '\0' body
+} shm_entry_t;
+
+static char *base;         // 이 프로세스의 매핑 주소
+static shm_header_t *H;
+static uint64_t *buckets;
+static uint8_t *page_class;
+static int my_slot = -1;
+
+#define PTR(off) ((void *)(base + (off)))
+#define OFF(ptr) ((uint64_t)((char *)(ptr) - base))
+#define ENTRY(off) ((shm_entry_t *)PTR(off))
+#define PAGE_CLASS(page) (&H->classes[page_class[((page) - H->first_page) / SHM_PAGE_SIZE]])
+
+static void rebuild_index(void);
+
+static void shm_lock(void)
+{
+  if (pthread_mutex_lock(&H->lock) == EOWNERDEAD) {
+    // 락을 잡은 채로 죽은 프로세스가 있다: 고치다 만 목록이 있을 수 있으므로 인덱스를 다시 만든다
+    pthread_mutex_consistent(&H->lock);
+    H->recoveries++;
+    rebuild_index();
+  }
+}
+
+static void shm_unlock(void)
+{
+  pthread_mutex_unlock(&H->lock);
+}
+
+static shm_class_t *class_of(size_t size)
+{
+  uint32_t i;
+
+  for (i = 0; i < H->nclasses; i++)
+    if (H->classes[i].chunk_size >= size)
+      return &H->classes[i];
+  return NULL;
+}
+
+static void held_add(shm_proc_t *proc, uint64_t off)
+{
+  proc->held[proc->nheld++] = off;
+}
+
+static void held_remove(shm_proc_t *proc, uint64_t off)
+{
+  uint32_t i;
+
+  for (i = 0; i < proc->nheld; i++) {
+    if (proc->held[i] == off) {
+      proc->held[i] = proc->held[--proc->nheld];
+      return;
+    }
+  }
+}
+
+static void free_entry(shm_entry_t *e)
+{
+  shm_class_t *cls = &H->classes[e->cls];
+  uint64_t off = OFF(e);
+
+  e->flags = SHM_FREE;
+  *(uint64_t *)e = cls->free_head;
+  cls->free_head = off;
+  cls->used--;
+}
+
+/* 참조 하나를 푼다. 인덱스에 없고 마지막 참조였으면 해제 */
+static void put_entry(shm_entry_t *e)
+{
+  if (--e->refcnt == 0 && !(e->flags & SHM_LIVE))
+    free_entry(e);
+}
+
+/* 죽은 프로세스가 잡고 있던 참조를 모두 푼다. 락 아래에서 호출 */
+static void reap_dead(void)
+{
+  int i;
+
+  for (i = 0; i < SHM_MAX_PROCS; i++) {
+    shm_proc_t *proc = &H->procs[i];
+    if (!proc->pid || i == my_slot || kill(proc->pid, 0) == 0 || errno != ESRCH)
+      continue;
+    while (proc->nheld)
+      put_entry(ENTRY(proc->held[--proc->nheld]));
+    proc->pid = 0;
+    H->reaped++;
+  }
+}
+
+static void lru_unlink(shm_class_t *cls, shm_entry_t *e)
+{
+  if (e->prev)
+    ENTRY(e->prev)->next = e->next;
+  else
+    cls->lru_head = e->next;
+  if (e->next)
+    ENTRY(e->next)->prev = e->prev;
+  else
+    cls->lru_tail = e->prev;
+  e->prev = e->next = 0;
+}
+
+static void lru_push(shm_class_t *cls, shm_entry_t *e)
+{
+  e->prev = 0;
+  e->next = cls->lru_head;
+  if (cls->lru_head)
+    ENTRY(cls->lru_head)->prev = OFF(e);
+  else
+    cls->lru_tail = OFF(e);
+  cls->lru_head = OFF(e);
+}
+
+/* 인덱스와 LRU에서 엔트리를 뺀다. 참조가 없으면 바로 해제 */
+static void unlink_entry(shm_entry_t *e)
+{
+  uint64_t *pp = &buckets[e->hash & (SHM_BUCKETS - 1)];
+
+  while (*pp && *pp != OFF(e))
+    pp = &ENTRY(*pp)->hnext;
+  if (*pp)
+    *pp = e->hnext;
+  lru_unlink(&H->classes[e->cls], e);
+  e->flags = SHM_EVICTED;
+  H->objects--;
+  H->bytes -= e->length;
+  if (e->refcnt == 0)
+    free_entry(e);
+}
+
+static uint64_t lookup(uint64_t hash, char *key, int key_len)
+{
+  uint64_t off;
+
+  for (off = buckets[hash & (SHM_BUCKETS - 1)]; off; off = ENTRY(off)->hnext) {
+    shm_entry_t *e = ENTRY(off);
+    if (e->hash == hash && e->key_len == key_len && !memcmp(e->key, key, key_len))
+      return off;
+  }
+  return 0;
+}
+
+static uint64_t find_entry(cache_key_t *key)
+{
+  return lookup(key->hash, key->str, key->len);
+}
+
+static void link_entry(shm_entry_t *e)
+{
+  uint64_t *bucket = &buckets[e->hash & (SHM_BUCKETS - 1)];
+
+  e->hnext = *bucket;
+  *bucket = OFF(e);
+  e->flags = SHM_LIVE;
+  lru_push(&H->classes[e->cls], e);
+  H->objects++;
+  H->bytes += e->length;
+}
+
+/* off가 배정된 페이지 안의 청크 시작이면 1 */
+static int valid_chunk(uint64_t off)
+{
+  uint64_t page = off - (off - H->first_page) % SHM_PAGE_SIZE;
+
+  return off >= H->first_page && off < H->next_page &&
+         (off - page) % PAGE_CLASS(page)->chunk_size == 0 &&
+         off - page + PAGE_CLASS(page)->chunk_size <= SHM_PAGE_SIZE;
+}
+
+/*
+ * 인덱스, LRU, 빈 목록을 청크 상태만 보고 처음부터 다시 만든다. 참조 수는 살아 있는
+ * 프로세스의 held 목록에서 다시 세고, 죽은 프로세스의 슬롯은 비운다. 락 아래에서 호출
+ */
+static void rebuild_index(void)
+{
+  uint64_t page, off, i;
+  shm_class_t *cls;
+  shm_entry_t *e;
+  int p;
+
+  memset(buckets, 0, SHM_BUCKETS * sizeof(uint64_t));
+  for (i = 0; i < H->nclasses; i++) {
+    cls = &H->classes[i];
+    cls->free_head = cls->lru_head = cls->lru_tail = 0;
+    cls->pages = cls->used = 0;
+  }
+  H->objects = H->bytes = 0;
+
+  for (page = H->first_page; page < H->next_page; page += SHM_PAGE_SIZE)
+    for (cls = PAGE_CLASS(page), off = page; off + cls->chunk_size <= page + SHM_PAGE_SIZE;
+         off += cls->chunk_size)
+      ENTRY(off)->refcnt = 0;
+  for (p = 0; p < SHM_MAX_PROCS; p++) {
+    shm_proc_t *proc = &H->procs[p];
+    if (!proc->pid)
+      continue;
+    if (p != my_slot && kill(proc->pid, 0) < 0 && errno == ESRCH) {
+      proc->pid = 0;
+      proc->nheld = 0;
+      H->reaped++;
+      continue;
+    }
+    for (i = 0; i < proc->nheld; i++)
+      if (valid_chunk(proc->held[i]))
+        ENTRY(proc->held[i])->refcnt++;
+  }
+
+  for (page = H->first_page; page < H->next_page; page += SHM_PAGE_SIZE) {
+    cls = PAGE_CLASS(page);
+    cls->pages++;
+    for (off = page; off + cls->chunk_size <= page + SHM_PAGE_SIZE; off += cls->chunk_size) {
+      e = ENTRY(off);
+      e->cls = cls - H->classes;
+      cls->used++; // 빈 청크로 돌리면 free_entry가 다시 뺀다
+      if (e->flags == SHM_LIVE &&
+          sizeof(shm_entry_t) + e->key_len + e->type_len + 2 + e->length <= cls->chunk_size) {
+        uint64_t dup = lookup(e->hash, e->key, e->key_len);
+        if (!dup) {
+          link_entry(e);
+          continue;
+        }
+        // 교체하다 죽어 같은 키가 둘 남았다: 나중에 캐싱된 쪽만 남긴다
+        if (ENTRY(dup)->cached_at < e->cached_at) {
+          unlink_entry(ENTRY(dup));
+          link_entry(e);
+        } else {
+          e->flags = SHM_EVICTED;
+          if (!e->refcnt)
+            free_entry(e);
+        }
+      } else if (!(e->flags == SHM_EVICTED || e->flags == SHM_FILLING) || !e->refcnt) {
+        free_entry(e);
+      }
+    }
+  }
+  H->rebuilds++;
+}
+
+/* 세그먼트를 처음부터 초기화한다. 세그먼트 파일에 flock을 잡은 채로 호출 */
+static void init_segment(size_t size)
+{
+  pthread_mutexattr_t attr;
+  size_t chunk = 64, max_chunk = sizeof(shm_entry_t) + MAX_OBJECT_SIZE + MAXLINE + 256 + 2;
+
+  memset(H, 0, sizeof(*H));
+  H->version = SHM_VERSION;
+  H->size = size;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&H->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  H->buckets_off = (sizeof(shm_header_t) + 63) & ~63UL;
+  H->page_class_off = H->buckets_off + SHM_BUCKETS * sizeof(uint64_t);
+  H->first_page = (H->page_class_off + size / SHM_PAGE_SIZE + SHM_PAGE_SIZE - 1) &
+                  ~(uint64_t)(SHM_PAGE_SIZE - 1);
+  H->next_page = H->first_page;
+  memset(base + H->buckets_off, 0, H->first_page - H->buckets_off);
+
+  // slab 할당기와 같은 방식의 크기 클래스
+  while (H->nclasses < SHM_MAX_CLASSES - 1 && chunk < max_chunk) {
+    H->classes[H->nclasses++].chunk_size = chunk;
+    chunk = ((size_t)(chunk * SLAB_GROWTH) + 15) & ~(size_t)15;
+  }
+  H->classes[H->nclasses++].chunk_size = (max_chunk + 15) & ~(size_t)15;
+
+  memcpy(H->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+  __sync_synchronize();
+  H->ready = 1;
+}
+
+/*
+ * shm_cache_open - 이름 있는 공유 메모리 세그먼트에 붙는다. 세그먼트에 flock을 잡고,
+ * 아직 초기화가 끝나지 않았으면(처음이거나 초기화하던 프로세스가 죽었으면) 초기화한다.
+ * 죽은 프로세스의 flock은 커널이 풀어 주므로 기다리다 멈추는 일은 없다.
+ */
+int shm_cache_open(char *name, size_t size)
+{
+  char shm_name[NAME_MAX];
+  struct stat st;
+  int fd, i;
+
+  snprintf(shm_name, sizeof(shm_name), "%s%s", name[0] == '/' ? "" : "/", name);
+  if ((fd = shm_open(shm_name, O_RDWR | O_CREAT, 0600)) < 0)
+    return -1;
+  if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0 ||
+      (st.st_size == 0 && ftruncate(fd, size) < 0)) {
+    close(fd);
+    return -1;
+  }
+  if (st.st_size)
+    size = st.st_size;
+
+  base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  H = (shm_header_t *)base;
+  if (!H->ready)
+    init_segment(size);
+  flock(fd, LOCK_UN); // 매핑이 파일을 붙잡고 있어 close만으로는 풀리지 않는다
+  close(fd);
+  if (memcmp(H->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) || H->version != SHM_VERSION) {
+    fprintf(stderr, "shm cache: %s is not a compatible cache segment\n", shm_name);
+    return -1;
+  }
+  buckets = PTR(H->buckets_off);
+  page_class = PTR(H->page_class_off);
+
+  // 프로세스 슬롯을 하나 차지한다. 죽은 프로세스의 슬롯은 먼저 회수
+  shm_lock();
+  reap_dead();
+  for (i = 0; i < SHM_MAX_PROCS && H->procs[i].pid; i++)
+    ;
+  if (i < SHM_MAX_PROCS) {
+    my_slot = i;
+    H->procs[i].pid = getpid();
+    H->procs[i].nheld = 0;
+  }
+  shm_unlock();
+
+  if (my_slot < 0) {
+    fprintf(stderr, "shm cache: too many processes attached to %s\n", shm_name);
+    return -1;
+  }
+  return 0;
+}
+
+int shm_cache_enabled(void)
+{
+  return my_slot >= 0;
+}
+
+static void fill_ref(shm_ref_t *ref, shm_entry_t *e)
+{
+  ref->off = OFF(e);
+  ref->length = e->length;
+  ref->content_type = e->key + e->key_len + 1;
+  ref->body = ref->content_type + e->type_len + 1;
+}
+
+/*
+ * shm_cache_find - 키를 찾아 참조를 잡고 1을 반환. 다 쓰면 shm_cache_release.
+ * 밴은 프로세스마다 따로 기록되므로, 이 프로세스의 밴에 걸린 객체는 여기서 모두에게서 지운다.
+ */
+int shm_cache_find(cache_key_t *key, shm_ref_t *ref)
+{
+  shm_proc_t *proc;
+  shm_entry_t *e;
+  uint64_t off;
+
+  if (my_slot < 0)
+    return 0;
+  shm_lock();
+  proc = &H->procs[my_slot];
+  if ((off = find_entry(key)) &&
+      ban_check(ENTRY(off)->key, ENTRY(off)->key_len, ENTRY(off)->cached_at, NULL, 0)) {
+    unlink_entry(ENTRY(off));
+    H->banned++;
+    off = 0;
+  }
+  if (!off || proc->nheld == SHM_MAX_HELD) {
+    H->misses++;
+    shm_unlock();
+    return 0;
+  }
+  e = ENTRY(off);
+  e->refcnt++;
+  held_add(proc, off);
+  lru_unlink(&H->classes[e->cls], e);
+  lru_push(&H->classes[e->cls], e);
+  H->hits++;
+  fill_ref(ref, e);
+  shm_unlock();
+  return 1;
+}
+
+void shm_cache_release(shm_ref_t *ref)
+{
+  shm_lock();
+  held_remove(&H->procs[my_slot], ref->off);
+  put_entry(ENTRY(ref->off));
+  shm_unlock();
+}
+
+/* 클래스에서 빈 청크 하나를 꺼낸다. 새 페이지도 없으면 그 클래스의 LRU 끝부터 제거 */
+static uint64_t alloc_chunk(shm_class_t *cls)
+{
+  uint64_t off;
+
+  if (!cls->free_head && H->next_page + SHM_PAGE_SIZE <= H->size) {
+    uint64_t page = H->next_page, n = SHM_PAGE_SIZE / cls->chunk_size, i;
+    page_class[(page - H->first_page) / SHM_PAGE_SIZE] = cls - H->classes;
+    H->next_page += SHM_PAGE_SIZE;
+    cls->pages++;
+    for (i = n; i-- > 0;) {
+      *(uint64_t *)PTR(page + i * cls->chunk_size) = cls->free_head;
+      cls->free_head = page + i * cls->chunk_size;
+    }
+  }
+  if (!cls->free_head)
+    reap_dead(); // 죽은 프로세스가 잡고 있던 청크가 있을 수 있다
+  while (!cls->free_head && cls->lru_tail) {
+    unlink_entry(ENTRY(cls->lru_tail));
+    H->evictions++;
+  }
+  if (!(off = cls->free_head))
+    return 0;
+  cls->free_head = *(uint64_t *)PTR(off);
+  cls->used++;
+  return off;
+}
+
+/*
+ * shm_cache_alloc - 본문 length 바이트를 담을 객체를 세그먼트에 만든다.
+ * 호출자가 ref->body를 채운 뒤 shm_cache_publish(또는 실패 시 shm_cache_abort)를 부른다.
+ */
+int shm_cache_alloc(cache_key_t *key, char *content_type, int length, shm_ref_t *ref)
+{
+  int type_len = strlen(content_type) > 255 ? 255 : strlen(content_type);
+  size_t size = sizeof(shm_entry_t) + key->len + type_len + 2 + length;
+  shm_class_t *cls;
+  shm_proc_t *proc;
+  shm_entry_t *e;
+  uint64_t off;
+
+  if (my_slot < 0)
+    return 0;
+  shm_lock();
+  proc = &H->procs[my_slot];
+  if (!(cls = class_of(size)) || proc->nheld == SHM_MAX_HELD || !(off = alloc_chunk(cls))) {
+    shm_unlock();
+    return 0;
+  }
+  e = ENTRY(off);
+  memset(e, 0, sizeof(*e));
+  e->hash = key->hash;
+  e->cached_at = ban_now();
+  e->length = length;
+  e->refcnt = 1; // 게시 전까지 이 프로세스가 잡고 있다
+  e->key_len = key->len;
+  e->type_len = type_len;
+  e->cls = cls - H->classes;
+  e->flags = SHM_FILLING;
+  memcpy(e->key, key->str, key->len + 1);
+  memcpy(e->key + key->len + 1, content_type, type_len);
+  e->key[key->len + 1 + type_len] = '\0';
+  held_add(proc, off);
+  shm_unlock();
+
+  fill_ref(ref, e);
+  return 1;
+}
+
+/* shm_cache_publish - 채운 객체를 인덱스에 넣는다. 같은 키의 이전 객체는 교체 */
+void shm_cache_publish(shm_ref_t *ref)
+{
+  shm_entry_t *e = ENTRY(ref->off);
+  uint64_t old;
+
+  shm_lock();
+  if ((old = lookup(e->hash, e->key, e->key_len)))
+    unlink_entry(ENTRY(old));
+  link_entry(e);
+  H->inserts++;
+  held_remove(&H->procs[my_slot], ref->off);
+  e->refcnt--;
+  shm_unlock();
+}
+
+/* shm_cache_abort - 게시하지 않을 객체를 돌려준다 */
+void shm_cache_abort(shm_ref_t *ref)
+{
+  shm_cache_release(ref);
+}
+
+/* shm_cache_purge - 키에 해당하는 객체를 모든 프로세스에서 지운다. 있었으면 1 */
+int shm_cache_purge(cache_key_t *key)
+{
+  uint64_t off;
+
+  if (my_slot < 0)
+    return 0;
+  shm_lock();
+  if ((off = find_entry(key))) {
+    unlink_entry(ENTRY(off));
+    H->purged++;
+  }
+  shm_unlock();
+  return off != 0;
+}
+
+int shm_cache_stats(char *buf, int size)
+{
+  int len, i, procs = 0;
+
+  if (my_slot < 0)
+    return 0;
+  shm_lock();
+  for (i = 0; i < SHM_MAX_PROCS; i++)
+    procs += H->procs[i].pid != 0;
+  len = snprintf(buf, size,
+                 "shm_size_bytes %lu\n"
+                 "shm_pages_used %lu\n"
+                 "shm_processes %d\n"
+                 "shm_objects %lu\n"
+                 "shm_body_bytes %lu\n"
+                 "shm_hits %lu\n"
+                 "shm_misses %lu\n"
+                 "shm_inserts %lu\n"
+                 "shm_evictions %lu\n"
+                 "shm_reaped_processes %lu\n"
+                 "shm_lock_recoveries %lu\n"
+                 "shm_index_rebuilds %lu\n"
+                 "shm_banned %lu\n"
+                 "shm_purged %lu\n",
+                 (unsigned long)H->size, (unsigned long)(H->next_page / SHM_PAGE_SIZE), procs,
+                 (unsigned long)H->objects, (unsigned long)H->bytes, (unsigned long)H->hits,
+                 (unsigned long)H->misses, (unsigned long)H->inserts, (unsigned long)H->evictions,
+                 (unsigned long)H->reaped, (unsigned long)H->recoveries, (unsigned long)H->rebuilds,
+                 (unsigned long)H->banned, (unsigned long)H->purged);
+  shm_unlock();
+  return len < size ? len : size;
+}
@@ -0,0 +1,43 @@
+/*
+ * shmcache.h - 같은 노드의 프록시 프로세스들이 함께 쓰는 공유 메모리 캐시
+ *
+ * shm_open으로 만든 세그먼트 하나에 인덱스, LRU, 할당기, 객체를 모두 두고
+ * 프로세스마다 매핑 주소가 다르므로 포인터 대신 세그먼트 시작으로부터의 오프셋을 쓴다.
+ * 인덱스는 robust 프로세스 공유 뮤텍스로 보호하고, 프로세스마다 잡고 있는 참조를
+ * 세그먼트 안에 기록해 두어 한 프로세스가 죽어도 다른 프로세스가 그 참조를 회수한다.
+ * 락을 잡은 채 죽었으면 청크마다 적힌 상태로 인덱스를 다시 만들고, 초기화 도중에 죽었으면
+ * 다음에 여는 프로세스가 다시 초기화한다.
+ */
+#ifndef __SHMCACHE_H__
+#define __SHMCACHE_H__
+
+#include "cache.h"
+
+#define SHM_MAGIC "PXYSHM"
+#define SHM_VERSION 3
+#define SHM_PAGE_SIZE (1 << 20)
+#define SHM_BUCKETS 16384  // 해시 버킷 수 (2의 거듭제곱)
+#define SHM_MAX_PROCS 64   // 동시에 붙을 수 있는 프로세스 수
+#define SHM_MAX_HELD 256   // 프로세스 하나가 동시에 잡을 수 있는 참조 수
+#define SHM_MAX_CLASSES 64
+
+/* 공유 캐시 객체에 대한 참조. 본문과 Content-type은 이 프로세스의 매핑 주소 */
+typedef struct
+{
+  uint64_t off;
+  char *body;
+  int length;
+  char *content_type;
+} shm_ref_t;
+
+int shm_cache_open(char *name, size_t size);
+int shm_cache_enabled(void);
+int shm_cache_find(cache_key_t *key, shm_ref_t *ref);
+void shm_cache_release(shm_ref_t *ref);
+int shm_cache_alloc(cache_key_t *key, char *content_type, int length, shm_ref_t *ref);
+void shm_cache_publish(shm_ref_t *ref);
+void shm_cache_abort(shm_ref_t *ref);
+int shm_cache_purge(cache_key_t *key);
+int shm_cache_stats(char *buf, int size);
+
+#endif /* __SHMCACHE_H__ */
@@ -0,0 +1,148 @@
+/*
+ * slab.c - 크기 클래스별 slab 할당기
+ */
+#include "csapp.h"
+#include "slab.h"
+
+#define MAX_SLAB_CLASSES 64
+
+typedef struct free_chunk_t
+{
+  struct free_chunk_t *next;
+} free_chunk_t;
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  size_t chunk_size;
+  free_chunk_t *free_list;
+  char *cur, *end;       // 아직 한 번도 나눠 주지 않은 arena 영역
+  size_t pages;          // 이 클래스에 배정된 arena 수
+  size_t used;           // 사용 중인 청크 수
+  size_t requested;      // 사용 중인 청크에 실제로 요청된 바이트 합
+} slab_class_t;
+
+static slab_class_t classes[MAX_SLAB_CLASSES];
+static int nclasses;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+static void slab_init(void)
+{
+  size_t size = SLAB_MIN_CHUNK;
+
+  while (nclasses < MAX_SLAB_CLASSES - 1 && size < SLAB_MAX_CHUNK) {
+    classes[nclasses++].chunk_size = size;
+    size = ((size_t)(size * SLAB_GROWTH) + 15) & ~(size_t)15; // 16바이트 정렬
+  }
+  classes[nclasses++].chunk_size = SLAB_MAX_CHUNK;
+
+  for (int i = 0; i < nclasses; i++)
+    pthread_mutex_init(&classes[i].lock, NULL);
+}
+
+/* size를 담을 수 있는 가장 작은 클래스, 없으면 NULL */
+static slab_class_t *class_of(size_t size)
+{
+  int lo = 0, hi;
+
+  Pthread_once(&slab_once, slab_init);
+  hi = nclasses - 1;
+  if (size > classes[hi].chunk_size)
+    return NULL;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (classes[mid].chunk_size >= size)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return &classes[lo];
+}
+
+/*
+ * slab_alloc - size 바이트 청크를 할당. free list를 먼저 쓰고,
+ * 비어 있으면 현재 arena를 잘라 쓰거나 새 arena를 받는다. 실패하면 NULL.
+ */
+void *slab_alloc(size_t size)
+{
+  slab_class_t *cls = class_of(size);
+  void *ptr = NULL;
+
+  if (!cls)
+    return NULL;
+
+  pthread_mutex_lock(&cls->lock);
+  if (cls->free_list) {
+    ptr = cls->free_list;
+    cls->free_list = cls->free_list->next;
+  } else {
+    if (cls->cur + cls->chunk_size > cls->end) {
+      char *page = mmap(NULL, SLAB_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (page == MAP_FAILED) {
+        pthread_mutex_unlock(&cls->lock);
+        return NULL;
+      }
+      cls->cur = page;
+      cls->end = page + SLAB_PAGE_SIZE;
+      cls->pages++;
+    }
+    ptr = cls->cur;
+    cls->cur += cls->chunk_size;
+  }
+  cls->used++;
+  cls->requested += size;
+  pthread_mutex_unlock(&cls->lock);
+  return ptr;
+}
+
+/* slab_free - slab_alloc(size)로 받은 청크를 클래스의 free list로 돌려준다 */
+void slab_free(void *ptr, size_t size)
+{
+  slab_class_t *cls = class_of(size);
+  free_chunk_t *chunk = ptr;
+
+  if (!ptr || !cls)
+    return;
+
+  pthread_mutex_lock(&cls->lock);
+  chunk->next = cls->free_list;
+  cls->free_list = chunk;
+  cls->used--;
+  cls->requested -= size;
+  pthread_mutex_unlock(&cls->lock);
+}
+
+/* slab_chunk_size - slab_alloc(size)가 실제로 차지하는 청크 크기, 담을 수 없으면 0 */
+size_t slab_chunk_size(size_t size)
+{
+  slab_class_t *cls = class_of(size);
+  return cls ? cls->chunk_size : 0;
+}
+
+/* slab_stats - 사용 중인 클래스별 arena 수, 청크 사용량, 내부 단편화를 buf에 쓴다 */
+int slab_stats(char *buf, int size)
+{
+  int i, len = 0;
+
+  Pthread_once(&slab_once, slab_init);
+  for (i = 0; i < nclasses && len < size; i++) {
+    slab_class_t *cls = &classes[i];
+    size_t pages, used, requested;
+
+    pthread_mutex_lock(&cls->lock);
+    pages = cls->pages;
+    used = cls->used;
+    requested = cls->requested;
+    pthread_mutex_unlock(&cls->lock);
+
+    if (!pages)
+      continue;
+    len += snprintf(buf + len, size - len,
+                    "slab_class %zu pages %zu chunks_used %zu chunks_total %zu "
+                    "bytes_requested %zu bytes_used %zu\n",
+                    cls->chunk_size, pages, used, pages * (SLAB_PAGE_SIZE / cls->chunk_size),
+                    requested, used * cls->chunk_size);
+  }
+  return len < size ? len : size;
+}
@@ -0,0 +1,23 @@
+/*
+ * slab.h - 캐시 객체 헤더와 본문을 위한 크기 클래스별 slab 할당기
+ *
+ * 큰 arena(SLAB_PAGE_SIZE)를 mmap으로 받아 한 크기 클래스에 통째로 배정하고
+ * 같은 크기의 청크로 잘라 쓴다. 해제된 청크는 클래스의 free list로 돌아가며
+ * arena는 운영체제에 돌려주지 않으므로 단편화가 클래스 안에서만 생기고 늘어나지 않는다.
+ */
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+
+#define SLAB_PAGE_SIZE (1 << 20)     // arena 하나의 크기
+#define SLAB_MIN_CHUNK 64
+#define SLAB_MAX_CHUNK (128 * 1024)  // MAX_OBJECT_SIZE보다 커야 한다
+#define SLAB_GROWTH 1.25             // 이웃한 크기 클래스의 비율
+
+void *slab_alloc(size_t size);
+void slab_free(void *ptr, size_t size);
+size_t slab_chunk_size(size_t size);
+int slab_stats(char *buf, int size);
+
+#endif /* __SLAB_H__ */
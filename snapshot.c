@@ -0,0 +1,361 @@
+/*
+ * snapshot.c - 캐시 스냅샷 쓰기와 mmap 기반 지연 로딩
+ *
+ * 파일 형식 (모든 정수는 호스트 바이트 순서):
+ *   snap_header_t | 레코드들 (key '\0' content_type '\0' body) | snap_slot_t[nslots]
+ * nslots는 2의 거듭제곱이고 선형 탐사로 찾는다. rec_off가 0인 슬롯은 비어 있다.
+ */
+#include "snapshot.h"
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t nslots;
+  uint64_t count;
+  uint64_t slots_off;
+  uint64_t file_size;
+} snap_header_t;
+
+typedef struct
+{
+  uint64_t hash;
+  uint64_t rec_off;
+  uint32_t body_len;
+  uint16_t key_len;
+  uint16_t type_len;
+} snap_slot_t;
+
+static char snap_path[MAXLINE];
+static pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER;  // 아래 상태 보호
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER; // 스냅샷 쓰기 직렬화
+
+/* 현재 mmap한 스냅샷 */
+static char *map;
+static size_t map_size;
+static snap_header_t *hdr;
+static snap_slot_t *slots;
+static unsigned char *dead; // 이미 메모리로 올렸거나 더 새로운 객체가 들어온 슬롯
+
+static unsigned long loaded, promoted, writes, write_errors;
+static double last_write_secs;
+
+/*
+ * snapshot_open - 스냅샷 경로를 정하고 파일이 있으면 mmap한다.
+ * 본문은 읽지 않으므로 파일 크기와 상관없이 바로 끝난다. 파일이 없거나
+ * 형식이 맞지 않으면 빈 캐시로 시작한다.
+ */
+int snapshot_open(char *path)
+{
+  struct stat st;
+  int fd;
+
+  snprintf(snap_path, MAXLINE, "%s", path);
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return errno == ENOENT ? 0 : -1;
+
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(snap_header_t)) {
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    map = NULL;
+    return -1;
+  }
+
+  hdr = (snap_header_t *)map;
+  if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) ||
+      hdr->version != SNAPSHOT_VERSION || hdr->file_size != (uint64_t)st.st_size ||
+      !hdr->nslots || (hdr->nslots & (hdr->nslots - 1)) || hdr->slots_off < sizeof(snap_header_t) ||
+      hdr->slots_off > hdr->file_size ||
+      (hdr->file_size - hdr->slots_off) / sizeof(snap_slot_t) < hdr->nslots) {
+    fprintf(stderr, "snapshot: ignoring %s (bad header or version)\n", path);
+    munmap(map, st.st_size);
+    map = NULL;
+    hdr = NULL;
+    return 0;
+  }
+  map_size = st.st_size;
+  slots = (snap_slot_t *)(map + hdr->slots_off);
+  dead = Calloc(hdr->nslots / 8 + 1, 1);
+  loaded = hdr->count;
+  madvise(map, map_size, MADV_RANDOM);
+  return 0;
+}
+
+int snapshot_enabled(void)
+{
+  return snap_path[0] != '\0';
+}
+
+/*
+ * 슬롯이 가리키는 레코드가 슬롯 배열 앞에 온전히 들어 있고 두 문자열이 '\0'으로 끝나면 1.
+ * 잘렸거나 깨진 파일의 슬롯은 빈 것으로 친다
+ */
+static int valid_slot(snap_slot_t *s)
+{
+  return s->rec_off >= sizeof(snap_header_t) && s->rec_off < hdr->slots_off && s->body_len <= MAX_OBJECT_SIZE &&
+         s->rec_off + s->key_len + s->type_len + 2 + s->body_len <= hdr->slots_off &&
+         map[s->rec_off + s->key_len] == '\0' && map[s->rec_off + s->key_len + s->type_len + 1] == '\0';
+}
+
+/* 키의 슬롯 번호, 없으면 -1. snap_lock 아래에서 호출 */
+static long find_slot(uint64_t hash, char *key, int key_len)
+{
+  uint32_t mask, i, n;
+
+  if (!hdr)
+    return -1;
+  mask = hdr->nslots - 1;
+  for (i = hash & mask, n = 0; slots[i].rec_off && n < hdr->nslots; i = (i + 1) & mask, n++) {
+    if (slots[i].hash == hash && slots[i].key_len == key_len && valid_slot(&slots[i]) &&
+        !memcmp(map + slots[i].rec_off, key, key_len))
+      return (dead[i / 8] & (1 << (i % 8))) ? -1 : (long)i;
+  }
+  return -1;
+}
+
+/*
+ * snapshot_promote - 스냅샷에 키가 있으면 본문을 메모리 캐시로 복사해 넣고 1을 반환.
+ * mmap한 페이지는 여기서 처음 읽히므로 시작 시간에는 영향을 주지 않는다.
+ * 스냅샷 객체는 이 프로세스의 어떤 밴보다도 먼저 캐싱됐으므로 cached_at을 0으로 둔다.
+ */
+int snapshot_promote(cache_key_t *key)
+{
+  web_object_t *web_object;
+  snap_slot_t *slot;
+  char *rec;
+  long i;
+
+  pthread_mutex_lock(&snap_lock);
+  if ((i = find_slot(key->hash, key->str, key->len)) < 0) {
+    pthread_mutex_unlock(&snap_lock);
+    return 0;
+  }
+  dead[i / 8] |= 1 << (i % 8);
+  slot = &slots[i];
+  rec = map + slot->rec_off;
+  pthread_mutex_unlock(&snap_lock);
+  if (ban_check(key->str, key->len, 0, NULL, 0))
+    return 0; // 밴에 걸린 사본은 죽은 채로 둔다
+
+  // 매핑은 해제하지 않으므로 락 밖에서 복사해도 안전하다
+  web_object = alloc_web_object(key, rec + slot->key_len + 1, slot->body_len);
+  if (!web_object)
+    return 0;
+  memcpy(web_object->response_ptr, rec + slot->key_len + slot->type_len + 2, slot->body_len);
+  web_object->cached_at = 0;
+  if (!write_cache(web_object)) {
+    // 입장 필터가 거절했다: 다음에 다시 올릴 수 있도록 스냅샷 사본을 살려 둔다
+    pthread_mutex_lock(&snap_lock);
+    dead[i / 8] &= ~(1 << (i % 8));
+    pthread_mutex_unlock(&snap_lock);
+    return 0;
+  }
+  __sync_fetch_and_add(&promoted, 1);
+  return 1;
+}
+
+/*
+ * snapshot_invalidate - 메모리 캐시에 더 새로운 객체가 들어오거나 퍼지되면 스냅샷 사본은
+ * 버린다. 있었으면 1
+ */
+int snapshot_invalidate(uint64_t hash, char *key, int key_len)
+{
+  long i;
+
+  if (!hdr)
+    return 0;
+  pthread_mutex_lock(&snap_lock);
+  if ((i = find_slot(hash, key, key_len)) >= 0)
+    dead[i / 8] |= 1 << (i % 8);
+  pthread_mutex_unlock(&snap_lock);
+  return i >= 0;
+}
+
+/* 레코드 하나를 쓰고 슬롯 정보를 채운다 */
+static int write_record(FILE *fp, uint64_t *off, snap_slot_t *slot, uint64_t hash,
+                        char *key, int key_len, char *type, int type_len, char *body, int body_len)
+{
+  slot->hash = hash;
+  slot->rec_off = *off;
+  slot->body_len = body_len;
+  slot->key_len = key_len;
+  slot->type_len = type_len;
+  if (fwrite(key, 1, key_len + 1, fp) != (size_t)key_len + 1 ||
+      fwrite(type, 1, type_len + 1, fp) != (size_t)type_len + 1 ||
+      fwrite(body, 1, body_len, fp) != (size_t)body_len)
+    return -1;
+  *off += key_len + type_len + 2 + body_len;
+  return 0;
+}
+
+/*
+ * snapshot_write - 메모리 캐시 전체와 아직 올라오지 않은 이전 스냅샷 항목을
+ * 임시 파일에 쓰고 rename으로 교체한다. 이미 mmap한 이전 파일은 그대로 유효하다.
+ */
+int snapshot_write(void)
+{
+  char tmp[MAXLINE + 8];
+  snap_header_t h = {{0}};
+  snap_slot_t *recs = NULL, *table = NULL;
+  web_object_t **objs;
+  struct timeval t0, t1;
+  uint64_t off = sizeof(h);
+  int i, n, nrecs = 0, cap;
+  uint32_t nslots = 1, old_slots;
+  FILE *fp;
+
+  if (!snap_path[0])
+    return 0;
+  pthread_mutex_lock(&write_lock);
+  gettimeofday(&t0, NULL);
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", snap_path);
+  if (!(fp = fopen(tmp, "w"))) {
+    fprintf(stderr, "snapshot: cannot create %s: %s\n", tmp, strerror(errno));
+    goto fail;
+  }
+  fseek(fp, sizeof(h), SEEK_SET);
+
+  objs = collect_cache(&n);
+  old_slots = hdr ? hdr->nslots : 0;
+  cap = n + old_slots;
+  recs = Malloc((cap ? cap : 1) * sizeof(snap_slot_t));
+
+  for (i = 0; i < n; i++) {
+    web_object_t *o = objs[i];
+    // 수명이 짧은 네거티브 항목과, 태그 id가 프로세스마다 다른 태그 객체, 형식에 자리가 없는
+    // gzip 객체와 Vary 색인·변형은 남기지 않는다. 밴은 프로세스를 넘어가지 않으므로 이미 밴에 걸린 객체도 걸러낸다
+    if (o->status == 200 && !o->ntags && o->encoding == OBJECT_IDENTITY && !o->vary && nrecs >= 0 &&
+        !ban_check(o->key, o->key_len, o->cached_at, NULL, 0))
+      nrecs = write_record(fp, &off, &recs[nrecs], o->hash, o->key, o->key_len, OBJECT_TYPE(o),
+                           o->type_len, o->response_ptr, o->content_length) == 0
+                  ? nrecs + 1
+                  : -1; // 쓰기 실패
+    release_cache(o);
+  }
+  free(objs);
+
+  // 아직 메모리로 올라오지 않은 이전 스냅샷 항목도 옮겨 적는다
+  for (i = 0; i < (int)old_slots && nrecs >= 0; i++) {
+    snap_slot_t *s = &slots[i];
+    char *rec = map + s->rec_off;
+    if (!s->rec_off || (dead[i / 8] & (1 << (i % 8))) || !valid_slot(s) ||
+        ban_check(rec, s->key_len, 0, NULL, 0))
+      continue;
+    if (write_record(fp, &off, &recs[nrecs], s->hash, rec, s->key_len, rec + s->key_len + 1,
+                     s->type_len, rec + s->key_len + s->type_len + 2, s->body_len) == 0)
+      nrecs++;
+    else
+      nrecs = -1;
+  }
+  if (nrecs < 0)
+    goto fail_file;
+
+  // 적재율 50% 이하의 open addressing 테이블
+  while (nslots < 2 * (uint32_t)nrecs)
+    nslots <<= 1;
+  table = Calloc(nslots, sizeof(snap_slot_t));
+  for (i = 0; i < nrecs; i++) {
+    uint32_t j = recs[i].hash & (nslots - 1);
+    while (table[j].rec_off)
+      j = (j + 1) & (nslots - 1);
+    table[j] = recs[i];
+  }
+
+  off = (off + 7) & ~7ULL;
+  memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  h.version = SNAPSHOT_VERSION;
+  h.nslots = nslots;
+  h.count = nrecs;
+  h.slots_off = off;
+  h.file_size = off + (uint64_t)nslots * sizeof(snap_slot_t);
+
+  if (fseek(fp, off, SEEK_SET) < 0 ||
+      fwrite(table, sizeof(snap_slot_t), nslots, fp) != nslots ||
+      fseek(fp, 0, SEEK_SET) < 0 || fwrite(&h, sizeof(h), 1, fp) != 1 ||
+      fflush(fp) != 0 || fsync(fileno(fp)) < 0)
+    goto fail_file;
+  fclose(fp);
+  if (rename(tmp, snap_path) < 0)
+    goto fail;
+
+  free(recs);
+  free(table);
+  gettimeofday(&t1, NULL);
+  last_write_secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+  writes++;
+  pthread_mutex_unlock(&write_lock);
+  return 0;
+
+fail_file:
+  fprintf(stderr, "snapshot: write to %s failed\n", tmp);
+  fclose(fp);
+  unlink(tmp);
+fail:
+  free(recs);
+  free(table);
+  write_errors++;
+  pthread_mutex_unlock(&write_lock);
+  return -1;
+}
+
+/* SIGTERM을 기다렸다가 스냅샷을 쓰고 종료한다 */
+static void *signal_thread(void *vargp)
+{
+  sigset_t *mask = vargp;
+  int sig;
+
+  Pthread_detach(pthread_self());
+  sigwait(mask, &sig);
+  snapshot_write();
+  exit(0);
+  return NULL;
+}
+
+static void *periodic_thread(void *vargp)
+{
+  int interval = (long)vargp;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    sleep(interval);
+    snapshot_write();
+  }
+  return NULL;
+}
+
+/*
+ * snapshot_start - SIGTERM 처리 스레드와 (interval > 0이면) 주기적 스냅샷 스레드를 띄운다.
+ * 호출자가 다른 스레드를 만들기 전에 모든 스레드에서 SIGTERM을 막아 두어야 한다.
+ */
+void snapshot_start(int interval)
+{
+  static sigset_t mask;
+  pthread_t tid;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGTERM);
+  Pthread_create(&tid, NULL, signal_thread, &mask);
+  if (interval > 0)
+    Pthread_create(&tid, NULL, periodic_thread, (void *)(long)interval);
+}
+
+int snapshot_stats(char *buf, int size)
+{
+  int len;
+
+  if (!snap_path[0])
+    return 0;
+  len = snprintf(buf, size,
+                 "snapshot_loaded_objects %lu\n"
+                 "snapshot_promoted %lu\n"
+                 "snapshot_writes %lu\n"
+                 "snapshot_write_errors %lu\n"
+                 "snapshot_last_write_secs %.3f\n",
+                 loaded, promoted, writes, write_errors, last_write_secs);
+  return len < size ? len : size;
+}
@@ -0,0 +1,24 @@
+/*
+ * snapshot.h - 재시작 후에도 캐시를 유지하기 위한 스냅샷 파일
+ *
+ * SIGTERM을 받거나 주기적으로 메모리 캐시의 인덱스와 본문을 버전이 붙은 파일 하나에 쓴다.
+ * 파일 끝의 슬롯 배열이 그대로 open addressing 해시 테이블이라서, 시작할 때는 mmap만 하면
+ * 인덱스를 바로 쓸 수 있고 본문 페이지는 처음 접근할 때 읽혀 메모리 캐시로 올라간다.
+ */
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "cache.h"
+
+#define SNAPSHOT_MAGIC "PXYSNAP"
+#define SNAPSHOT_VERSION 1
+
+int snapshot_open(char *path);
+int snapshot_enabled(void);
+void snapshot_start(int interval);
+int snapshot_write(void);
+int snapshot_promote(cache_key_t *key);
+int snapshot_invalidate(uint64_t hash, char *key, int key_len);
+int snapshot_stats(char *buf, int size);
+
+#endif /* __SNAPSHOT_H__ */
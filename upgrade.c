@@ -0,0 +1,243 @@
+/*
+ * upgrade.c - 리스닝 소켓과 캐시를 새 바이너리에 넘기는 무중단 업그레이드
+ *
+ * SIGUSR2 → (캐시 넘길 준비) → fork + execve(시작할 때 찾아 둔 바이너리 경로) → 새 프로세스가 준비 파이프에 1바이트
+ * → 이전 프로세스는 accept를 멈추고 처리 중인 요청이 끝나면 종료.
+ * 새 프로세스가 제시간에 준비되지 않으면 업그레이드를 취소하고 그대로 서비스한다.
+ */
+#include <poll.h>
+#include <sys/syscall.h>
+#include "upgrade.h"
+#include "snapshot.h"
+#include "shmcache.h"
+
+extern char **environ;
+
+static char **saved_argv;
+static char exe_path[MAXLINE]; // 시작할 때 찾아 둔 이 바이너리의 절대 경로
+static int saved_listenfd = -1;
+static volatile int draining;
+static int inflight; // 처리 중인 연결 수
+static char handoff_path[MAXLINE]; // -s 없이 캐시를 넘길 때 쓰는 임시 스냅샷
+
+/* upgrade_listenfd - 이전 프로세스에게 물려받은 리스닝 소켓, 없으면 -1 */
+int upgrade_listenfd(void)
+{
+  char *s = getenv(UPGRADE_LISTEN_ENV);
+  int fd;
+
+  if (!s)
+    return -1;
+  fd = atoi(s);
+  unsetenv(UPGRADE_LISTEN_ENV);
+
+  // -s 없이 넘어온 캐시는 임시 스냅샷에 있다. 매핑은 unlink 뒤에도 유효하다
+  if ((s = getenv(UPGRADE_SNAPSHOT_ENV))) {
+    snprintf(handoff_path, MAXLINE, "%s", s);
+    unsetenv(UPGRADE_SNAPSHOT_ENV);
+  }
+  return fd;
+}
+
+/* 이전 프로세스가 남긴 임시 스냅샷을 연다. -s를 준 경우에는 그 파일이 대신 넘어온다 */
+static void inherit_handoff(void)
+{
+  if (!handoff_path[0] || snapshot_enabled())
+    return;
+  snapshot_open(handoff_path);
+  unlink(handoff_path);
+}
+
+/* upgrade_ready - 새 프로세스의 준비가 끝났음을 이전 프로세스에 알린다 */
+void upgrade_ready(void)
+{
+  char *s = getenv(UPGRADE_READY_ENV);
+  int fd;
+
+  inherit_handoff();
+  if (!s)
+    return;
+  fd = atoi(s);
+  unsetenv(UPGRADE_READY_ENV);
+  if (write(fd, "1", 1) < 0)
+    fprintf(stderr, "upgrade: cannot notify old process: %s\n", strerror(errno));
+  close(fd);
+}
+
+/* csapp.h가 _GNU_SOURCE와 충돌하므로 close_range는 시스템 호출로 부른다 */
+static void close_range_fds(unsigned int lo, unsigned int hi)
+{
+  syscall(SYS_close_range, lo, hi, 0);
+}
+
+/* a < b인 두 fd와 표준 입출력만 남기고 모두 닫는다 */
+static void close_except(int a, int b)
+{
+  if (a > 3)
+    close_range_fds(3, a - 1);
+  if (b > a + 1)
+    close_range_fds(a + 1, b - 1);
+  close_range_fds(b + 1, ~0U);
+}
+
+/* 새 바이너리를 띄우고 준비될 때까지 기다린다. 성공하면 0 */
+static int exec_new_binary(void)
+{
+  char listen_env[32], ready_env[32], snap_env[MAXLINE + 32], **envp;
+  struct pollfd pfd;
+  int pipefd[2], n, i;
+  sigset_t empty;
+  pid_t pid;
+  char c;
+
+  // 공유 메모리 캐시는 세그먼트가 그대로 이어진다. 아니면 스냅샷을 써서 넘긴다
+  if (!shm_cache_enabled() && !snapshot_enabled()) {
+    snprintf(handoff_path, MAXLINE, "/tmp/proxy-handoff.%d", getpid());
+    unlink(handoff_path);
+    snapshot_open(handoff_path);
+  }
+  if (snapshot_enabled() && snapshot_write() < 0)
+    fprintf(stderr, "upgrade: cache snapshot failed, new process starts cold\n");
+
+  if (pipe(pipefd) < 0)
+    return -1;
+  fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+
+  // fork한 자식에서는 malloc을 쓸 수 없으므로 환경 변수는 미리 만들어 둔다
+  for (n = 0; environ[n]; n++)
+    ;
+  envp = Malloc((n + 4) * sizeof(char *));
+  for (i = 0; i < n; i++)
+    envp[i] = environ[i];
+  snprintf(listen_env, sizeof(listen_env), "%s=%d", UPGRADE_LISTEN_ENV, saved_listenfd);
+  snprintf(ready_env, sizeof(ready_env), "%s=%d", UPGRADE_READY_ENV, pipefd[1]);
+  envp[n++] = listen_env;
+  envp[n++] = ready_env;
+  if (handoff_path[0]) {
+    snprintf(snap_env, sizeof(snap_env), "%s=%s", UPGRADE_SNAPSHOT_ENV, handoff_path);
+    envp[n++] = snap_env;
+  }
+  envp[n] = NULL;
+
+  if ((pid = fork()) == 0) {
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+    if (saved_listenfd < pipefd[1])
+      close_except(saved_listenfd, pipefd[1]);
+    else
+      close_except(pipefd[1], saved_listenfd);
+    execve(exe_path, saved_argv, envp);
+    _exit(127);
+  }
+  close(pipefd[1]);
+  free(envp);
+  if (pid < 0) {
+    close(pipefd[0]);
+    return -1;
+  }
+
+  pfd.fd = pipefd[0];
+  pfd.events = POLLIN;
+  n = poll(&pfd, 1, UPGRADE_READY_TIMEOUT * 1000) == 1 && read(pipefd[0], &c, 1) == 1;
+  close(pipefd[0]);
+  if (!n) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+  return 0;
+}
+
+static void *upgrade_thread(void *vargp)
+{
+  sigset_t *mask = vargp;
+  int sig;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    sigwait(mask, &sig);
+    if (exec_new_binary() == 0) {
+      draining = 1;
+      return NULL;
+    }
+    fprintf(stderr, "upgrade: new binary %s did not start, still serving\n", exe_path);
+  }
+}
+
+/*
+ * exec할 바이너리 경로를 절대 경로로 정해 둔다. argv[0]은 PATH로 찾은 이름이거나
+ * 시작할 때의 작업 디렉터리 기준 상대 경로일 수 있으므로 그대로 exec하지 않는다.
+ * 새 바이너리를 같은 경로에 덮어쓰기 전에 읽어야 하므로 업그레이드 전에 한 번만 부른다.
+ */
+static void resolve_exe_path(char *argv0)
+{
+  ssize_t n = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+  char *path;
+
+  if (n > 0) {
+    exe_path[n] = '\0';
+    return;
+  }
+  if ((path = realpath(argv0, NULL)) && strlen(path) < sizeof(exe_path)) {
+    strcpy(exe_path, path);
+  } else {
+    fprintf(stderr, "upgrade: cannot resolve %s, using it as is\n", argv0);
+    snprintf(exe_path, sizeof(exe_path), "%s", argv0);
+  }
+  free(path);
+}
+
+/*
+ * upgrade_start - SIGUSR2를 기다리는 스레드를 띄운다. 호출자가 다른 스레드를 만들기 전에
+ * 모든 스레드에서 SIGUSR2를 막아 두어야 한다. 두 프로세스가 한 소켓을 같이 기다리는 동안 한쪽이
+ * accept에서 멈추지 않도록 리스닝 소켓은 논블로킹으로 바꾼다.
+ */
+void upgrade_start(char **argv, int listenfd)
+{
+  static sigset_t mask;
+  pthread_t tid;
+
+  saved_argv = argv;
+  saved_listenfd = listenfd;
+  resolve_exe_path(argv[0]);
+  fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR2);
+  Pthread_create(&tid, NULL, upgrade_thread, &mask);
+}
+
+/* upgrade_accept - 새 연결을 받는다. 업그레이드로 물러나는 중이면 -1 */
+int upgrade_accept(int listenfd, SA *addr, socklen_t *addrlen)
+{
+  struct pollfd pfd = { listenfd, POLLIN, 0 };
+  int connfd;
+
+  while (!draining) {
+    if (poll(&pfd, 1, 1000) <= 0)
+      continue;
+    if ((connfd = accept(listenfd, addr, addrlen)) >= 0)
+      return connfd;
+  }
+  return -1;
+}
+
+/* upgrade_drain - 처리 중인 연결이 모두 끝나면(또는 제한 시간이 지나면) 종료한다 */
+void upgrade_drain(void)
+{
+  int i;
+
+  for (i = 0; i < UPGRADE_DRAIN_TIMEOUT * 10 && inflight > 0; i++)
+    usleep(100000);
+  exit(0);
+}
+
+void upgrade_enter(void)
+{
+  __sync_fetch_and_add(&inflight, 1);
+}
+
+void upgrade_leave(void)
+{
+  __sync_fetch_and_sub(&inflight, 1);
+}
@@ -0,0 +1,28 @@
+/*
+ * upgrade.h - SIGUSR2로 새 바이너리에 무중단으로 넘겨주기
+ *
+ * 이전 프로세스는 캐시를 넘길 준비를 한 뒤 리스닝 소켓을 물려준 채 새 바이너리를 exec한다.
+ * 새 프로세스가 준비됐다고 알려 오면 이전 프로세스는 accept를 멈추고 처리 중인 요청만
+ * 마저 끝낸 뒤 종료한다. 소켓은 한 번도 닫히지 않으므로 그 사이 들어온 연결은 backlog에서
+ * 기다렸다가 둘 중 한 프로세스가 받는다.
+ */
+#ifndef __UPGRADE_H__
+#define __UPGRADE_H__
+
+#include "csapp.h"
+
+#define UPGRADE_LISTEN_ENV "PROXY_LISTEN_FD"      // 물려받은 리스닝 소켓 번호
+#define UPGRADE_READY_ENV "PROXY_READY_FD"        // 준비 완료를 알릴 파이프
+#define UPGRADE_SNAPSHOT_ENV "PROXY_HANDOFF_SNAPSHOT" // -s 없이 캐시를 넘길 임시 스냅샷
+#define UPGRADE_READY_TIMEOUT 30 // 새 프로세스가 준비될 때까지 기다리는 시간 (초)
+#define UPGRADE_DRAIN_TIMEOUT 60 // 처리 중인 요청을 기다리는 최대 시간 (초)
+
+int upgrade_listenfd(void);
+void upgrade_start(char **argv, int listenfd);
+void upgrade_ready(void);
+int upgrade_accept(int listenfd, SA *addr, socklen_t *addrlen);
+void upgrade_drain(void);
+void upgrade_enter(void);
+void upgrade_leave(void);
+
+#endif /* __UPGRADE_H__ */